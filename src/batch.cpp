@@ -0,0 +1,478 @@
+#include "cpu.h"
+#include "cart.h"
+#include "emu.h"
+#include "ppu.h"
+#include "input.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+using namespace dsemu;
+
+/*
+  Runs many short ROM jobs at once, one Machine per worker thread.
+
+  The job list has one job per line, key=value fields, values with spaces
+  in double quotes, # starts a comment:
+
+      rom="roms/03-op sp,hl.gb" frames=3000 collect=serial
+      rom=game.gb frames=600 movie=run1.txt collect=ram,frame
+
+  collect picks what goes in the result, any of ram, frame and serial, all
+  three by default.  A movie is text, one change per line: the frame it
+  applies at and the buttons held from then on, as hex DSEMU_BUTTON_* bits.
+
+      0 00
+      120 80
+      124 00
+
+  Jobs are dealt out to per-worker queues.  A worker takes from the back of
+  its own and, once that is empty, steals from the front of the others, so
+  a few long jobs do not hold up the rest.
+
+  Each result is a JSON line, in the order jobs finish.  Battery RAM is
+  never saved and nothing is paced, so a job gives the same result whatever
+  else runs next to it.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+const int COLLECT_RAM = 1;
+const int COLLECT_FRAME = 2;
+const int COLLECT_SERIAL = 4;
+
+struct MovieEntry {
+    int frame;
+    byte buttons;
+};
+
+struct Job {
+    int line;
+    string rom;
+    string movie;
+    int frames;
+    int collect;
+};
+
+struct Worker {
+    std::mutex lock;
+    std::deque<int> jobs;
+};
+
+static std::vector<Job> jobs;
+static std::vector<Worker> workers;
+
+static std::mutex outLock;
+static std::ostream *out = &cout;
+
+static std::mutex totalsLock;
+static uint64_t totalFrames = 0;
+static uint64_t totalCycles = 0;
+
+//the job a worker runs, for the serial hook.
+static thread_local string *serialOut = nullptr;
+
+static void onSerial(Machine &m, byte b) {
+    if (serialOut) {
+        serialOut->push_back((char)b);
+    }
+}
+
+static uint64_t hash(const void *data, size_t size) {
+    const byte *p = (const byte *)data;
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i=0; i<size; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static string hex64(uint64_t v) {
+    char s[17];
+    snprintf(s, sizeof(s), "%016llx", (unsigned long long)v);
+    return s;
+}
+
+static string jsonString(const string &s) {
+    string r = "\"";
+
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        } else if (c == '\n') {
+            r += "\\n";
+        } else if (c < 0x20 || c >= 0x7F) {
+            char e[7];
+            snprintf(e, sizeof(e), "\\u%04x", c);
+            r += e;
+        } else {
+            r += c;
+        }
+    }
+
+    return r + "\"";
+}
+
+//splits a job line into key=value fields, false on a malformed one.
+static bool parseFields(const string &line, std::vector<std::pair<string, string>> &fields) {
+    size_t i = 0;
+
+    while (true) {
+        while (i < line.size() && isspace((unsigned char)line[i])) i++;
+
+        if (i == line.size() || line[i] == '#') {
+            return true;
+        }
+
+        size_t eq = line.find('=', i);
+
+        if (eq == string::npos) {
+            return false;
+        }
+
+        string key = line.substr(i, eq - i);
+        string value;
+        i = eq + 1;
+
+        if (i < line.size() && line[i] == '"') {
+            size_t end = line.find('"', i + 1);
+
+            if (end == string::npos) {
+                return false;
+            }
+
+            value = line.substr(i + 1, end - i - 1);
+            i = end + 1;
+        } else {
+            size_t end = i;
+            while (end < line.size() && !isspace((unsigned char)line[end])) end++;
+
+            value = line.substr(i, end - i);
+            i = end;
+        }
+
+        fields.push_back({key, value});
+    }
+}
+
+static bool parseCollect(const string &value, int &collect) {
+    collect = 0;
+    size_t start = 0;
+
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        string what = value.substr(start, end == string::npos ? string::npos : end - start);
+
+        if (what == "ram") {
+            collect |= COLLECT_RAM;
+        } else if (what == "frame") {
+            collect |= COLLECT_FRAME;
+        } else if (what == "serial") {
+            collect |= COLLECT_SERIAL;
+        } else if (!what.empty()) {
+            return false;
+        }
+
+        if (end == string::npos) {
+            break;
+        }
+
+        start = end + 1;
+    }
+
+    return true;
+}
+
+static bool loadJobs(std::istream &in, int defaultFrames) {
+    string line;
+    int n = 0;
+
+    while (std::getline(in, line)) {
+        n++;
+
+        std::vector<std::pair<string, string>> fields;
+
+        if (!parseFields(line, fields)) {
+            std::cerr << "Job line " << n << ": cannot parse" << endl;
+            return false;
+        }
+
+        if (fields.empty()) {
+            continue;
+        }
+
+        Job job = {n, "", "", defaultFrames, COLLECT_RAM | COLLECT_FRAME | COLLECT_SERIAL};
+
+        for (auto &f : fields) {
+            if (f.first == "rom") {
+                job.rom = f.second;
+            } else if (f.first == "frames") {
+                job.frames = atoi(f.second.c_str());
+            } else if (f.first == "movie") {
+                job.movie = f.second;
+            } else if (f.first == "collect" && parseCollect(f.second, job.collect)) {
+                continue;
+            } else {
+                std::cerr << "Job line " << n << ": unknown field " << f.first << "=" << f.second << endl;
+                return false;
+            }
+        }
+
+        if (job.rom.empty()) {
+            std::cerr << "Job line " << n << ": no rom" << endl;
+            return false;
+        }
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+static bool loadMovie(const string &file, std::vector<MovieEntry> &movie) {
+    std::ifstream in(file);
+    string line;
+
+    if (!in) {
+        return false;
+    }
+
+    while (std::getline(in, line)) {
+        int frame;
+        unsigned buttons;
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (sscanf(line.c_str(), "%d %x", &frame, &buttons) != 2) {
+            return false;
+        }
+
+        movie.push_back({frame, (byte)buttons});
+    }
+
+    std::stable_sort(movie.begin(), movie.end(), [](const MovieEntry &a, const MovieEntry &b) {
+        return a.frame < b.frame;
+    });
+
+    return true;
+}
+
+static string runJob(Machine &m, const Job &job) {
+    Clock::time_point start = Clock::now();
+    std::vector<MovieEntry> movie;
+    string serial;
+    string error;
+
+    if (!job.movie.empty() && !loadMovie(job.movie, movie)) {
+        error = "cannot read movie " + job.movie;
+    } else if (!cart::load(m, job.rom, "")) {
+        error = "cannot load " + job.rom;
+    }
+
+    string r = "{\"line\":" + std::to_string(job.line) + ",\"rom\":" + jsonString(job.rom);
+
+    if (!error.empty()) {
+        return r + ",\"error\":" + jsonString(error) + "}";
+    }
+
+    std::memset(m.ram, 0, sizeof(m.ram));
+
+    //only the last frame is looked at, so only that one is drawn.
+    ppu::setRenderInterval(m, 0);
+    dsemu::init(m);
+
+    serialOut = &serial;
+
+    size_t next = 0;
+
+    for (int f=0; f<job.frames; f++) {
+        while (next < movie.size() && movie[next].frame <= f) {
+            input::set(m, movie[next++].buttons);
+        }
+
+        if (f == job.frames - 1 && (job.collect & COLLECT_FRAME)) {
+            ppu::setRenderInterval(m, 1);
+        }
+
+        runFrames(m, 1);
+    }
+
+    serialOut = nullptr;
+
+    double wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    uint64_t cycles = cpu::getTickCount(m);
+
+    r += ",\"frames\":" + std::to_string(m.ppu.currentFrame) + ",\"cycles\":" + std::to_string(cycles);
+
+    if (job.collect & COLLECT_RAM) {
+        r += ",\"ram_hash\":\"" + hex64(hash(m.ram, sizeof(m.ram))) + "\"";
+    }
+
+    if (job.collect & COLLECT_FRAME) {
+        const uint32_t *frame = ppu::takeFrame(m);
+
+        if (frame) {
+            r += ",\"frame_hash\":\"" + hex64(hash(frame, ppu::XRES * ppu::YRES * sizeof(uint32_t))) + "\"";
+        }
+    }
+
+    if (job.collect & COLLECT_SERIAL) {
+        r += ",\"serial\":" + jsonString(serial);
+    }
+
+    char wall[32];
+    snprintf(wall, sizeof(wall), "%.3f", wallMs);
+    r += ",\"wall_ms\":" + string(wall) + "}";
+
+    std::lock_guard<std::mutex> lock(totalsLock);
+    totalFrames += m.ppu.currentFrame;
+    totalCycles += cycles;
+
+    return r;
+}
+
+//own queue from the back, then steal from the front of the others.
+static bool takeJob(int self, int &job) {
+    int count = workers.size();
+
+    for (int i=0; i<count; i++) {
+        Worker &w = workers[(self + i) % count];
+        std::lock_guard<std::mutex> lock(w.lock);
+
+        if (w.jobs.empty()) {
+            continue;
+        }
+
+        if (i == 0) {
+            job = w.jobs.back();
+            w.jobs.pop_back();
+        } else {
+            job = w.jobs.front();
+            w.jobs.pop_front();
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+static void work(int self) {
+    Machine *m = new Machine();
+    m->io.onSerial = onSerial;
+
+    int job;
+
+    while (takeJob(self, job)) {
+        string result = runJob(*m, jobs[job]);
+
+        std::lock_guard<std::mutex> lock(outLock);
+        *out << result << "\n";
+        out->flush();
+    }
+
+    cart::unload(*m);
+    delete m;
+}
+
+int main(int argc, char **argv) {
+    string jobFile;
+    string outFile;
+    int threads = std::thread::hardware_concurrency();
+    int frames = 60;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc) {
+            outFile = argv[++i];
+        } else if (arg == "--no-idle-skip") {
+            cpu::idleSkip = false;
+        } else if (arg == "--prefetch") {
+            cart::prefetchROM = true;
+        } else {
+            jobFile = arg;
+        }
+    }
+
+    if (jobFile.empty()) {
+        std::cerr << "Usage: dsemu-batch [--threads N] [--frames N] [--out results.jsonl] jobs.txt|-" << endl;
+        return -1;
+    }
+
+    bool loaded;
+
+    if (jobFile == "-") {
+        loaded = loadJobs(std::cin, frames);
+    } else {
+        std::ifstream in(jobFile);
+
+        if (!in) {
+            std::cerr << "Unable to open job list: " << jobFile << endl;
+            return -1;
+        }
+
+        loaded = loadJobs(in, frames);
+    }
+
+    if (!loaded) {
+        return -1;
+    }
+
+    std::ofstream outStream;
+
+    if (!outFile.empty()) {
+        outStream.open(outFile);
+
+        if (!outStream) {
+            std::cerr << "Unable to open " << outFile << endl;
+            return -1;
+        }
+
+        out = &outStream;
+    }
+
+    threads = std::max(1, std::min(threads, (int)jobs.size()));
+    cart::verbose = false;
+
+    workers = std::vector<Worker>(threads);
+
+    for (size_t i=0; i<jobs.size(); i++) {
+        workers[i % threads].jobs.push_back(i);
+    }
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> pool;
+
+    for (int i=0; i<threads; i++) {
+        pool.emplace_back(work, i);
+    }
+
+    for (std::thread &t : pool) {
+        t.join();
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cerr << "Jobs: " << jobs.size() << " - Threads: " << threads
+              << " - Frames: " << totalFrames << " - Cycles: " << totalCycles
+              << std::fixed << std::setprecision(2)
+              << " - Wall: " << seconds << "s - FPS: " << totalFrames / seconds
+              << " (" << totalFrames / seconds / threads << " per thread)" << endl;
+
+    return 0;
+}
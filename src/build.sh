@@ -1,2 +1,2 @@
-g++ -O2 -Werror=all -std=c++17 *.cpp -lSDL2 -lpthread -o emu
-    
+g++ -O2 -Werror=all -std=c++17 $(ls *.cpp | grep -v headless.cpp) -lSDL2 -lpthread -o emu
+g++ -O2 -Werror=all -std=c++17 $(ls *.cpp | grep -v -x -e main.cpp -e ui.cpp -e viewer.cpp) -lpthread -o emu-headless
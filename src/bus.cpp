@@ -5,64 +5,121 @@
 #include "io.h"
 #include "cpu.h"
 
-#include <unistd.h>
 #include <cstring>
 
 namespace dsemu::bus {
 
-    byte bankNumber = 1;
-
-    byte read(ushort address) {
-        if (address < 0x8000) {
-            return cart::read(address); // memory::read(address);
-        } else if (address < 0xA000) {
-            return memory::read(address);
-        } else if (address < 0xFE00) {
-            return memory::read(address);
-        } else if (address < 0xFEA0) {
-            return ppu::readOAM(address - 0xFE00);
-        } else if (address < 0xFEFF) {
-            return 0;
-        } else if (address < 0xFF80) {
-            return io::read(address);
-        } else if (address < 0xFFFF) {
-            return memory::read(address);
-        } else {
-            return cpu::getInterruptsEnableFlag();
+    static byte readCart(Machine &m, ushort address) {
+        return cart::read(m, address);
+    }
+
+    static void writeCart(Machine &m, ushort address, byte b) {
+        cart::control(m, address, b);
+    }
+
+    //VRAM writes go through the PPU to keep its tile cache current.
+    static void writeTileData(Machine &m, ushort address, byte b) {
+        ppu::writeVRAM(m, address, b);
+    }
+
+    //cart RAM pages only get here while no RAM bank is mapped.
+    static byte readCartRAM(Machine &m, ushort address) {
+        return cart::readRAM(m, address);
+    }
+
+    static void writeCartRAM(Machine &m, ushort address, byte b) {
+        cart::writeRAM(m, address, b);
+    }
+
+    //FE00-FEFF: OAM and the unusable area after it.
+    static byte readOAMPage(Machine &m, ushort address) {
+        if (address < 0xFEA0) {
+            return ppu::readOAM(m, address - 0xFE00);
         }
+
+        return 0;
     }
 
-    void write(ushort address, ushort s) {
-        
-        write(address, (byte)(s & 0xFF));
-        write(address + 1, (byte)((s >> 8) & 0xFF));
+    static void writeOAMPage(Machine &m, ushort address, byte b) {
+        if (address < 0xFEA0) {
+            ppu::writeOAM(m, address - 0xFE00, b);
+        }
     }
 
-    void write(ushort address, byte b) {
-
-        if (address < 0x8000) {
-            cart::control(address, b);
-        } else if (address < 0xA000) {
-            if (address == 0xDD00 || address == 0xDD01) {
-                cout << "WRITING TO " << Short(address) << " = " << Byte(b) << endl;
-                sleep(2);
-            }
-            memory::write(address, b);
-        } 
-        else if (address < 0xFE00) {
-            memory::write(address, b);
-        } else if (address < 0xFEA0) {
-            ppu::writeOAM(address - 0xFE00, b);
-
-        } else if (address < 0xFEFF) {
-        } else if (address < 0xFF80) {
-            io::write(address, b);
+    //FF00-FFFF: I/O registers, HRAM and IE.
+    static byte readIOPage(Machine &m, ushort address) {
+        if (address < 0xFF80) {
+            return io::read(m, address);
         } else if (address < 0xFFFF) {
-            memory::write(address, b);
+            return m.ram[address];
         } else {
-            cpu::setInterruptsEnableFlag(b);
+            return cpu::getInterruptsEnableFlag(m);
         }
     }
 
-}
+    static void writeIOPage(Machine &m, ushort address, byte b) {
+        if (address < 0xFF80) {
+            io::write(m, address, b);
+        } else if (address < 0xFFFF) {
+            m.ram[address] = b;
+        } else {
+            cpu::setInterruptsEnableFlag(m, b);
+        }
+    }
 
+    void mapRead(Machine &m, byte first, int count, byte *mem) {
+        for (int i=0; i<count; i++) {
+            m.bus.readPages[first + i] = mem ? mem + (i << 8) : nullptr;
+        }
+    }
+
+    void mapWrite(Machine &m, byte first, int count, byte *mem) {
+        for (int i=0; i<count; i++) {
+            m.bus.writePages[first + i] = mem ? mem + (i << 8) : nullptr;
+        }
+    }
+
+    void init(Machine &m) {
+        for (int i=0; i<0x80; i++) {
+            m.bus.readHandlers[i] = readCart;
+            m.bus.writeHandlers[i] = writeCart;
+        }
+
+        for (int i=0xA0; i<0xC0; i++) {
+            m.bus.readHandlers[i] = readCartRAM;
+            m.bus.writeHandlers[i] = writeCartRAM;
+        }
+
+        for (int i=0x80; i<0xA0; i++) {
+            m.bus.writeHandlers[i] = writeTileData;
+        }
+
+        m.bus.readHandlers[0xFE] = readOAMPage;
+        m.bus.readHandlers[0xFF] = readIOPage;
+        m.bus.writeHandlers[0xFE] = writeOAMPage;
+        m.bus.writeHandlers[0xFF] = writeIOPage;
+
+        //ROM is read only, writes are mapper control.
+        mapRead(m, 0x00, 0x80, nullptr);
+        mapWrite(m, 0x00, 0x80, nullptr);
+
+        //VRAM and WRAM, tile data writes go to the handler.  The pixel FIFO
+        //also has to catch up before a tile map write.
+        mapRead(m, 0x80, 0x20, m.ram + 0x8000);
+        mapWrite(m, 0x80, 0x18, nullptr);
+        mapWrite(m, 0x98, 0x08, DSEMU_PPU_FIFO ? nullptr : m.ram + 0x9800);
+        mapRead(m, 0xC0, 0x20, m.ram + 0xC000);
+        mapWrite(m, 0xC0, 0x20, m.ram + 0xC000);
+
+        //echo RAM, E000-FDFF is a mirror of C000-DDFF.
+        mapRead(m, 0xE0, 0x1E, m.ram + 0xC000);
+        mapWrite(m, 0xE0, 0x1E, m.ram + 0xC000);
+
+        //ROM banks and cart RAM.
+        cart::mapPages(m);
+
+        mapRead(m, 0xFE, 2, nullptr);
+        mapWrite(m, 0xFE, 2, nullptr);
+    }
+
+}
@@ -1,10 +1,51 @@
 #pragma once
 #include "common.h"
+#include "machine.h"
+
+/*
+  The address space is split into 256 pages of 256 bytes.  A page that is
+  plain memory has a host pointer in readPages/writePages and is accessed
+  with a single indexed load, anything else (ROM control writes, OAM, I/O
+  registers) has a null pointer and goes through the page's handler.
+
+  Bank switches and anything else that moves memory around remap pages with
+  map() instead of being checked on every access.
+*/
 
 namespace dsemu::bus {
 
-byte read(ushort address);
-void write(ushort address, byte b);
-void write(ushort address, ushort s);
+void init(Machine &m);
+
+//points count pages starting at page first at mem, null sends them to the handler.
+void mapRead(Machine &m, byte first, int count, byte *mem);
+void mapWrite(Machine &m, byte first, int count, byte *mem);
+
+inline byte read(Machine &m, ushort address) {
+    byte *page = m.bus.readPages[address >> 8];
+
+    if (page) {
+        return page[address & 0xFF];
+    }
+
+    return m.bus.readHandlers[address >> 8](m, address);
+}
+
+inline void write(Machine &m, ushort address, byte b) {
+    m.cpu.volatileAccess = true;
+
+    byte *page = m.bus.writePages[address >> 8];
+
+    if (page) {
+        page[address & 0xFF] = b;
+        return;
+    }
+
+    m.bus.writeHandlers[address >> 8](m, address, b);
+}
+
+inline void write(Machine &m, ushort address, ushort s) {
+    write(m, address, (byte)(s & 0xFF));
+    write(m, address + 1, (byte)((s >> 8) & 0xFF));
+}
 
 }
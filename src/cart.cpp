@@ -2,80 +2,387 @@
 
 #include "mappers.h"
 
-#include <fstream>
 #include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <set>
+#include <mutex>
 
 using std::memcpy;
+using std::memset;
 
 namespace dsemu::cart {
 
-Header g_header;
+bool prefetchROM = false;
+std::atomic<bool> verbose(true);
 
-mappers::Mapper *mapper = nullptr;
+/*
+  ROM images are read only mappings of the ROM file, shared by everything in
+  the process that loads the same file (same device and inode), and unmapped
+  when the last user lets go.
+*/
+struct RomImage {
+    byte *data;
+    size_t size;
+    bool mapped;
+    int refs;
+};
 
-byte *g_romData = nullptr;
-int g_romSize = 0;
+static std::map<std::pair<dev_t, ino_t>, RomImage> romImages;
+static std::mutex romImagesLock;
 
-bool load(const string &romFile) {
-    std::ifstream in(romFile, std::ios::binary);
+byte *acquireROM(const string &romFile, int &size) {
+    int fd = ::open(romFile.c_str(), O_RDONLY);
+    struct stat st;
 
-    if (!in) {
-        cout << "Unable to open ROM: " << romFile << " - " << strerror(errno) << endl;
-        return false;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(romImagesLock);
+    RomImage &image = romImages[std::make_pair(st.st_dev, st.st_ino)];
+
+    if (image.refs == 0) {
+        image.size = st.st_size;
+        image.mapped = false;
+        image.data = nullptr;
+
+        //smaller than the two ROM windows, pad a private copy instead.
+        if (image.size >= 0x8000) {
+            int flags = MAP_PRIVATE | (prefetchROM ? MAP_POPULATE : 0);
+            void *p = mmap(nullptr, image.size, PROT_READ, flags, fd, 0);
+
+            if (p != MAP_FAILED) {
+                image.data = (byte *)p;
+                image.mapped = true;
+
+                if (prefetchROM) {
+                    madvise(p, image.size, MADV_WILLNEED);
+                }
+            }
+        }
+
+        if (!image.mapped) {
+            size_t size = std::max(image.size, (size_t)0x8000);
+            image.data = new byte[size];
+            memset(image.data, 0xFF, size);
+
+            if (pread(fd, image.data, image.size, 0) != (ssize_t)image.size) {
+                delete[] image.data;
+                ::close(fd);
+                romImages.erase(std::make_pair(st.st_dev, st.st_ino));
+                return nullptr;
+            }
+
+            image.size = size;
+        }
+    }
+
+    ::close(fd);
+
+    image.refs++;
+    size = image.size;
+
+    return image.data;
+}
+
+void releaseROM(byte *data) {
+    std::lock_guard<std::mutex> lock(romImagesLock);
+
+    for (auto it = romImages.begin(); it != romImages.end(); it++) {
+        RomImage &image = it->second;
+
+        if (image.data != data) {
+            continue;
+        }
+
+        if (--image.refs == 0) {
+            if (image.mapped) {
+                munmap(image.data, image.size);
+            } else {
+                delete[] image.data;
+            }
+
+            romImages.erase(it);
+        }
+
+        return;
+    }
+}
+
+//header RAM size code to bytes.
+static const int ramSizes[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
+static string savFile(const string &romFile) {
+    size_t dot = romFile.find_last_of('.');
+    size_t slash = romFile.find_last_of('/');
+
+    if (dot != string::npos && (slash == string::npos || dot > slash)) {
+        return romFile.substr(0, dot) + ".sav";
+    }
+
+    return romFile + ".sav";
+}
+
+static void closeRAM(Machine &m) {
+    State &c = m.cart;
+
+    if (c.savMapSize) {
+        msync(c.ramData, c.savMapSize, MS_SYNC);
+        munmap(c.ramData, c.savMapSize);
+        c.savMapSize = 0;
+    } else {
+        delete[] c.ramData;
+    }
+
+    c.ramData = nullptr;
+    c.rtcSave = nullptr;
+}
+
+//machines with a cart loaded, saved if the process exits while they run.
+static std::set<Machine *> loaded;
+static std::mutex loadedLock;
+
+static void saveAtExit() {
+    std::lock_guard<std::mutex> lock(loadedLock);
+
+    for (Machine *m : loaded) {
+        mappers::flush(*m);
+        closeRAM(*m);
+    }
+
+    loaded.clear();
+}
+
+/*
+  Battery backed RAM is a shared mapping of the .sav file, so the game writes
+  straight into the page cache and saving costs nothing while it runs.  The
+  mappers msync the banks that were in use when the game disables the RAM.
+*/
+static void openRAM(Machine &m, const string &file, size_t size) {
+    State &c = m.cart;
+    closeRAM(m);
+
+    if (size == 0) {
+        return;
+    }
+
+    if (m.mappers.mapper.battery && !file.empty()) {
+        int fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+        struct stat st;
+
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            bool fresh = st.st_size == 0;
+
+            if ((size_t)st.st_size >= size || ftruncate(fd, size) == 0) {
+                void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+                if (p != MAP_FAILED) {
+                    c.ramData = (byte *)p;
+                    c.savMapSize = size;
+
+                    if (fresh) {
+                        memset(c.ramData, 0xFF, c.ramSize);
+                    }
+
+                    if (verbose) {
+                        cout << "\t    Save: " << file << endl;
+                    }
+                }
+            }
+        }
+
+        if (fd >= 0) {
+            ::close(fd);
+        }
+
+        if (!c.savMapSize) {
+            std::cerr << "Unable to map save file: " << file << " - " << strerror(errno) << endl;
+        }
+    }
+
+    if (!c.savMapSize) {
+        c.ramData = new byte[size];
+        memset(c.ramData, 0xFF, c.ramSize);
+        memset(c.ramData + c.ramSize, 0, size - c.ramSize);
+    }
+
+    if (m.mappers.mapper.rtc) {
+        c.rtcSave = (RTCSave *)(c.ramData + c.ramSize);
+    }
+}
+
+//msync() wants whole pages, the banks and the RTC block are not page aligned.
+void flushRAM(Machine &m, int offset, int length) {
+    State &c = m.cart;
+
+    if (!c.savMapSize) {
+        return;
+    }
+
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t start = offset / pageSize * pageSize;
+    size_t end = std::min((offset + length + pageSize - 1) / pageSize * pageSize,
+                          (c.savMapSize + pageSize - 1) / pageSize * pageSize);
+
+    if (msync(c.ramData + start, end - start, MS_ASYNC) != 0 && verbose) {
+        std::cerr << "Unable to flush save: " << strerror(errno) << endl;
+    }
+}
+
+static void releaseCurrent(Machine &m) {
+    State &c = m.cart;
+
+    if (c.romData == c.bufferROM) {
+        delete[] c.bufferROM;
+        c.bufferROM = nullptr;
+    } else if (c.romData != nullptr) {
+        releaseROM(c.romData);
     }
 
-    if (g_romData != nullptr) {
-        delete[] g_romData;
-    }
-
-    in.seekg(0, in.end);
-    g_romSize = in.tellg();
-    in.seekg(0, in.beg);
-
-    g_romData = new byte[g_romSize];
-
-    in.read((char *)g_romData, g_romSize);
-
-    memcpy(&g_header, g_romData + 0x100, sizeof(Header));
-    in.close();
-
-    cout << "Loaded Rom: " << romFile << endl;
-    cout << "\t    Size: " << g_romSize << endl;
-    cout << "\t   Title: " << g_header.title << endl;
-    cout << "\tCart Typ: " << Byte(g_header.cartType) << endl;
-    cout << "\tCGB Flag: " << Byte(g_header.gbcFlag) << endl;
-    cout << "\tSGB Flag: " << Byte(g_header.sgbFlag) << endl;
-    cout << "\tROM Size: " << Byte(g_header.romSize) << endl;
-    cout << "\tRAM Size: " << Byte(g_header.ramSize) << endl;
-    cout << "\tJap Flag: " << Byte(g_header.japFlag) << endl;
-    cout << "\t   Entry: " << Byte(g_header.entry[0]) << " "
-                           << Byte(g_header.entry[1]) << " "
-                           << Byte(g_header.entry[2]) << " "
-                           << Byte(g_header.entry[3]) << endl;
-
-    switch(g_header.cartType) {
-        case 0: {
-            mapper = new mappers::NROMMapper();
-        } break;
-        case 1: {
-            mapper = new mappers::MPC1();
-        } break;
-        default: {
-            cout << "UNSUPPORTED MAPPER" << endl;
-            exit(-1);
+    c.romData = nullptr;
+}
+
+void unload(Machine &m) {
+    {
+        std::lock_guard<std::mutex> lock(loadedLock);
+
+        if (!loaded.erase(&m)) {
+            return;
         }
     }
 
+    mappers::flush(m);
+    closeRAM(m);
+    releaseCurrent(m);
+}
+
+void reset(Machine &m) {
+    State &c = m.cart;
+
+    if (c.ramData && !c.savMapSize) {
+        memset(c.ramData, 0xFF, c.ramSize);
+
+        if (c.rtcSave) {
+            memset(c.rtcSave, 0, sizeof(RTCSave));
+        }
+    }
+
+    mappers::reset(m);
+}
+
+static bool start(Machine &m, const string &name, const string &saveFile) {
+    State &c = m.cart;
+    memcpy(&c.header, c.romData + 0x100, sizeof(Header));
+
+    if (verbose) {
+        cout << "Loaded Rom: " << name << endl;
+        cout << "\t    Size: " << c.romSize << endl;
+        cout << "\t   Title: " << string(c.header.title, strnlen(c.header.title, sizeof(c.header.title))) << endl;
+        cout << "\tCart Typ: " << Byte(c.header.cartType) << endl;
+        cout << "\tCGB Flag: " << Byte(c.header.gbcFlag) << endl;
+        cout << "\tSGB Flag: " << Byte(c.header.sgbFlag) << endl;
+        cout << "\tROM Size: " << Byte(c.header.romSize) << endl;
+        cout << "\tRAM Size: " << Byte(c.header.ramSize) << endl;
+        cout << "\tJap Flag: " << Byte(c.header.japFlag) << endl;
+        cout << "\t   Entry: " << Byte(c.header.entry[0]) << " "
+                               << Byte(c.header.entry[1]) << " "
+                               << Byte(c.header.entry[2]) << " "
+                               << Byte(c.header.entry[3]) << endl;
+    }
+
+    if (!mappers::init(m, c.header.cartType)) {
+        std::cerr << "Unsupported mapper: " << Byte(c.header.cartType) << endl;
+        releaseCurrent(m);
+        return false;
+    }
+
+    //2KB carts are still given a whole 8KB page range, the rest stays unused.
+    c.ramSize = c.header.ramSize < 6 ? ramSizes[c.header.ramSize] : 0;
+
+    if (c.ramSize) {
+        c.ramSize = std::max(c.ramSize, 0x2000);
+    }
+
+    openRAM(m, saveFile, c.ramSize + (m.mappers.mapper.rtc ? sizeof(RTCSave) : 0));
+    mappers::reset(m);
+
+    std::lock_guard<std::mutex> lock(loadedLock);
+    static bool exitHandler = false;
+
+    if (!exitHandler) {
+        atexit(saveAtExit);
+        exitHandler = true;
+    }
+
+    loaded.insert(&m);
+
     return true;
+}
+
+bool load(Machine &m, const string &romFile) {
+    return load(m, romFile, savFile(romFile));
+}
+
+bool load(Machine &m, const string &romFile, const string &saveFile) {
+    int size = 0;
+    byte *data = acquireROM(romFile, size);
+
+    if (data == nullptr) {
+        std::cerr << "Unable to open ROM: " << romFile << " - " << strerror(errno) << endl;
+        return false;
+    }
+
+    unload(m);
+
+    m.cart.romData = data;
+    m.cart.romSize = size;
+
+    return start(m, romFile, saveFile);
+}
+
+bool load(Machine &m, const byte *data, int size) {
+    State &c = m.cart;
+
+    if (data == nullptr || size < 0x150) {
+        std::cerr << "ROM image too small: " << size << endl;
+        return false;
+    }
+
+    unload(m);
+
+    //padded to the two ROM windows like a short ROM file.
+    c.romSize = std::max(size, 0x8000);
+    c.bufferROM = new byte[c.romSize];
+    memset(c.bufferROM, 0xFF, c.romSize);
+    memcpy(c.bufferROM, data, size);
+    c.romData = c.bufferROM;
+
+    return start(m, "(memory)", "");
+}
+
+byte read(Machine &m, ushort address) {
+    return m.mappers.mapper.romBanks[address >> 14][address & 0x3FFF];
+}
+
+void control(Machine &m, ushort address, byte b) {
+    m.mappers.mapper.control(m, address, b);
+}
 
+void mapPages(Machine &m) {
+    mappers::mapPages(m);
 }
 
-byte read(ushort address) {
-    return mapper->read(address);
+byte readRAM(Machine &m, ushort address) {
+    return m.mappers.mapper.readRAM(m, address);
 }
 
-void control(ushort address, byte b) {
-    mapper->control(address, b);
+void writeRAM(Machine &m, ushort address, byte b) {
+    m.mappers.mapper.writeRAM(m, address, b);
 }
 
 }
\ No newline at end of file
@@ -1,33 +1,46 @@
 #pragma once
 
 #include "common.h"
+#include "machine.h"
 
 namespace dsemu::cart {
 
-struct Header {
-    byte entry[4];
-    byte logo[0x30];
-
-    char title[16];
-    byte gbcFlag;
-    byte licCode[2];
-    byte sgbFlag;
-    byte cartType;
-    byte romSize;
-    byte ramSize;
-    byte japFlag;
-    byte oldLicCode;
-    byte maskRomVersion;
-    byte headerChecksum;
-    byte globalChecksum[2];
-};
-
-extern Header g_header;
-extern byte *g_romData;
-extern int g_romSize;
-
-bool load(const string &romFile);
-byte read(ushort address);
-void control(ushort address, byte b);
+//populate ROM mappings up front instead of faulting pages in as they are used.
+extern bool prefetchROM;
+
+//print the header of every ROM loaded, batch runs and the C API turn it off.
+extern std::atomic<bool> verbose;
+
+//false if the ROM cannot be read or its mapper is not supported.
+bool load(Machine &m, const string &romFile);
+
+//battery RAM goes to saveFile instead of the .sav next to the ROM, or
+//nowhere if it is empty.
+bool load(Machine &m, const string &romFile, const string &saveFile);
+
+//loads a copy of a ROM image in memory, battery RAM is not saved anywhere.
+bool load(Machine &m, const byte *data, int size);
+
+//saves and lets go of the ROM and cart RAM, before a Machine goes away.
+void unload(Machine &m);
+
+//back to how loading left the cart, without loading it again.  Battery RAM
+//in a save file is kept, cart RAM that is not saved anywhere is cleared.
+void reset(Machine &m);
+
+//shared read only image of a ROM file, size is the usable length.
+byte *acquireROM(const string &romFile, int &size);
+void releaseROM(byte *data);
+
+byte read(Machine &m, ushort address);
+void control(Machine &m, ushort address, byte b);
+void mapPages(Machine &m);
+
+//cart RAM accesses that are not plain memory.
+byte readRAM(Machine &m, ushort address);
+void writeRAM(Machine &m, ushort address, byte b);
+
+//schedules a write back of part of a battery backed save, a no-op otherwise.
+void flushRAM(Machine &m, int offset, int length);
 
 }
@@ -0,0 +1,232 @@
+#include "compositor.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DSEMU_X86 1
+#include <immintrin.h>
+#else
+#define DSEMU_X86 0
+#endif
+
+namespace dsemu::compositor {
+
+typedef void (*COMPOSE_HANDLER)(const Line &line, const byte *shades, uint32_t *out);
+
+/*
+  Each pixel becomes an index into a 12 entry shade table: 0-3 for BG
+  colours through BGP, 4-7 for OBP0 and 8-11 for OBP1.  A sprite pixel wins
+  unless it is colour 0, or it is behind the BG and the BG is not colour 0.
+*/
+static void composeScalar(const Line &line, const byte *shades, uint32_t *out) {
+    for (int span=0; span<WIDTH; span += 32) {
+        if (!objInSpan(line, span, 32)) {
+            for (int x=span; x<span + 32; x++) {
+                out[x] = colors[shades[line.bg[x]]];
+            }
+
+            continue;
+        }
+
+        for (int x=span; x<span + 32; x++) {
+            byte obj = line.obj[x];
+            byte attr = line.objAttr[x];
+            bool visible = obj && !((attr & 0x80) && line.bg[x]);
+            byte index = visible ? ((attr & 0x10 ? 8 : 4) + obj) : line.bg[x];
+
+            out[x] = colors[shades[index]];
+        }
+    }
+}
+
+#if DSEMU_X86
+
+__attribute__((target("ssse3")))
+static void composeSSSE3(const Line &line, const byte *shades, uint32_t *out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i behindBit = _mm_set1_epi8((char)0x80);
+    const __m128i paletteBit = _mm_set1_epi8(0x10);
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i shadeTable = _mm_loadu_si128((const __m128i *)shades);
+
+    //one byte of each colour per table, indexed by shade.
+    __m128i b = _mm_setr_epi8(colors[0], colors[1], colors[2], colors[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i g = _mm_setr_epi8(colors[0] >> 8, colors[1] >> 8, colors[2] >> 8, colors[3] >> 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i r = _mm_setr_epi8(colors[0] >> 16, colors[1] >> 16, colors[2] >> 16, colors[3] >> 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i a = _mm_setr_epi8(colors[0] >> 24, colors[1] >> 24, colors[2] >> 24, colors[3] >> 24, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    for (int x=0; x<WIDTH; x += 16) {
+        __m128i bg = _mm_loadu_si128((const __m128i *)(line.bg + x));
+        __m128i index = bg;
+
+        if (objInSpan(line, x, 16)) {
+            __m128i obj = _mm_loadu_si128((const __m128i *)(line.obj + x));
+            __m128i attr = _mm_loadu_si128((const __m128i *)(line.objAttr + x));
+
+            __m128i noObj = _mm_cmpeq_epi8(obj, zero);
+            __m128i behind = _mm_andnot_si128(_mm_cmpeq_epi8(bg, zero), _mm_cmpeq_epi8(_mm_and_si128(attr, behindBit), behindBit));
+            __m128i hidden = _mm_or_si128(noObj, behind);
+
+            __m128i palette = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(attr, paletteBit), paletteBit), four);
+            __m128i objIndex = _mm_add_epi8(_mm_add_epi8(obj, four), palette);
+            index = _mm_or_si128(_mm_and_si128(hidden, bg), _mm_andnot_si128(hidden, objIndex));
+        }
+
+        __m128i shade = _mm_shuffle_epi8(shadeTable, index);
+
+        __m128i bs = _mm_shuffle_epi8(b, shade);
+        __m128i gs = _mm_shuffle_epi8(g, shade);
+        __m128i rs = _mm_shuffle_epi8(r, shade);
+        __m128i as = _mm_shuffle_epi8(a, shade);
+
+        __m128i bgLo = _mm_unpacklo_epi8(bs, gs);
+        __m128i bgHi = _mm_unpackhi_epi8(bs, gs);
+        __m128i raLo = _mm_unpacklo_epi8(rs, as);
+        __m128i raHi = _mm_unpackhi_epi8(rs, as);
+
+        __m128i *dst = (__m128i *)(out + x);
+        _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(bgLo, raLo));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(bgLo, raLo));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(bgHi, raHi));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(bgHi, raHi));
+    }
+}
+
+__attribute__((target("avx2")))
+static void composeAVX2(const Line &line, const byte *shades, uint32_t *out) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i behindBit = _mm256_set1_epi8((char)0x80);
+    const __m256i paletteBit = _mm256_set1_epi8(0x10);
+    const __m256i four = _mm256_set1_epi8(4);
+    const __m256i shadeTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)shades));
+    const __m256i colorTable = _mm256_setr_epi32(colors[0], colors[1], colors[2], colors[3], 0, 0, 0, 0);
+
+    for (int x=0; x<WIDTH; x += 32) {
+        __m256i bg = _mm256_loadu_si256((const __m256i *)(line.bg + x));
+        __m256i index = bg;
+
+        if (objInSpan(line, x, 32)) {
+            __m256i obj = _mm256_loadu_si256((const __m256i *)(line.obj + x));
+            __m256i attr = _mm256_loadu_si256((const __m256i *)(line.objAttr + x));
+
+            __m256i noObj = _mm256_cmpeq_epi8(obj, zero);
+            __m256i behind = _mm256_andnot_si256(_mm256_cmpeq_epi8(bg, zero), _mm256_cmpeq_epi8(_mm256_and_si256(attr, behindBit), behindBit));
+            __m256i hidden = _mm256_or_si256(noObj, behind);
+
+            __m256i palette = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(attr, paletteBit), paletteBit), four);
+            __m256i objIndex = _mm256_add_epi8(_mm256_add_epi8(obj, four), palette);
+            index = _mm256_blendv_epi8(objIndex, bg, hidden);
+        }
+
+        __m256i shade = _mm256_shuffle_epi8(shadeTable, index);
+
+        __m128i lo = _mm256_castsi256_si128(shade);
+        __m128i hi = _mm256_extracti128_si256(shade, 1);
+
+        __m256i *dst = (__m256i *)(out + x);
+        _mm256_storeu_si256(dst + 0, _mm256_permutevar8x32_epi32(colorTable, _mm256_cvtepu8_epi32(lo)));
+        _mm256_storeu_si256(dst + 1, _mm256_permutevar8x32_epi32(colorTable, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8))));
+        _mm256_storeu_si256(dst + 2, _mm256_permutevar8x32_epi32(colorTable, _mm256_cvtepu8_epi32(hi)));
+        _mm256_storeu_si256(dst + 3, _mm256_permutevar8x32_epi32(colorTable, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8))));
+    }
+}
+
+static_assert(WIDTH % 32 == 0, "the AVX2 path composes 32 pixels at a time");
+
+#endif
+
+static const COMPOSE_HANDLER handlers[BackendCount] = {
+    composeScalar,
+#if DSEMU_X86
+    composeSSSE3,
+    composeAVX2
+#else
+    nullptr,
+    nullptr
+#endif
+};
+
+static bool supported(Backend b) {
+    switch(b) {
+        case BackendScalar: return true;
+#if DSEMU_X86
+        case BackendSSSE3: return __builtin_cpu_supports("ssse3");
+        case BackendAVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+Backend best() {
+    for (int b=BackendCount - 1; b>BackendScalar; b--) {
+        if (supported((Backend)b)) {
+            return (Backend)b;
+        }
+    }
+
+    return BackendScalar;
+}
+
+static Backend backend = best();
+
+bool select(Backend b) {
+    if (b >= BackendCount || !supported(b)) {
+        return false;
+    }
+
+    backend = b;
+    return true;
+}
+
+Backend current() {
+    return backend;
+}
+
+const char *name(Backend b) {
+    switch(b) {
+        case BackendScalar: return "scalar";
+        case BackendSSSE3: return "ssse3";
+        case BackendAVX2: return "avx2";
+        default: return "unknown";
+    }
+}
+
+static void shadeTable(byte bgp, byte obp0, byte obp1, byte *shades) {
+    for (int i=0; i<4; i++) {
+        shades[i] = (bgp >> (i * 2)) & 3;
+        shades[4 + i] = (obp0 >> (i * 2)) & 3;
+        shades[8 + i] = (obp1 >> (i * 2)) & 3;
+    }
+}
+
+void compose(const Line &line, byte bgp, byte obp0, byte obp1, uint32_t *out) {
+    byte shades[16] = {0};
+    shadeTable(bgp, obp0, obp1, shades);
+
+    handlers[backend](line, shades, out);
+}
+
+//composeScalar() without the colour lookup.
+void composeIndex(const Line &line, byte bgp, byte obp0, byte obp1, byte *out) {
+    byte shades[16] = {0};
+    shadeTable(bgp, obp0, obp1, shades);
+
+    for (int span=0; span<WIDTH; span += 32) {
+        if (!objInSpan(line, span, 32)) {
+            for (int x=span; x<span + 32; x++) {
+                out[x] = shades[line.bg[x]];
+            }
+
+            continue;
+        }
+
+        for (int x=span; x<span + 32; x++) {
+            byte obj = line.obj[x];
+            byte attr = line.objAttr[x];
+            bool visible = obj && !((attr & 0x80) && line.bg[x]);
+            byte index = visible ? ((attr & 0x10 ? 8 : 4) + obj) : line.bg[x];
+
+            out[x] = shades[index];
+        }
+    }
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.h"
+
+/*
+  Scanline compositor.
+
+  The PPU builds a line as three 160 byte layers and compose() merges them
+  and maps the result through the palettes into 32 bit pixels.  Spans that
+  no sprite covers skip the merge, the sprite layers are not even read
+  there.  The SIMD backends are picked at run time from what the CPU
+  supports, tools/compositor_test.cpp (make check) holds every backend to
+  the same result.
+*/
+
+namespace dsemu::compositor {
+
+const int WIDTH = 160;
+
+//ARGB8888 of the four DMG shades, lightest first.
+const uint32_t colors[4] = {0xFFFFFFFF, 0xFFC0C0C0, 0xFF808080, 0xFF000000};
+
+struct Line {
+    byte bg[WIDTH];         //BG/window colour index 0-3
+    byte obj[WIDTH];        //sprite colour index 1-3, 0 where there is none
+    byte objAttr[WIDTH];    //OAM flags of that sprite, bit 7 behind BG, bit 4 OBP1
+    uint64_t objMask[(WIDTH + 63) / 64];    //pixels any sprite covers
+};
+
+//true if a sprite covers any of the n pixels from x, n a power of two up to 64 and x a multiple of it.
+inline bool objInSpan(const Line &line, int x, int n) {
+    uint64_t bits = n == 64 ? ~0ULL : (1ULL << n) - 1;
+
+    return (line.objMask[x >> 6] >> (x & 63)) & bits;
+}
+
+enum Backend {
+    BackendScalar,
+    BackendSSSE3,
+    BackendAVX2,
+    BackendCount
+};
+
+//best backend the CPU supports.
+Backend best();
+
+//false if the CPU does not support it.
+bool select(Backend b);
+
+Backend current();
+const char *name(Backend b);
+
+void compose(const Line &line, byte bgp, byte obp0, byte obp1, uint32_t *out);
+
+//the same merge, but out gets the shade (0-3) of each pixel instead of its colour.
+void composeIndex(const Line &line, byte bgp, byte obp0, byte obp1, byte *out);
+
+}
@@ -1,246 +1,271 @@
 #include "cpu.h"
+#include "opcodes.h"
 #include "memory.h"
 #include "ppu.h"
 #include "bus.h"
-
-#include <fstream>
-#include <sstream>
-#include <SDL2/SDL.h>
+#include "trace.h"
+#include "scheduler.h"
 
 namespace dsemu {
 namespace cpu {
 
-extern bool interruptsEnabled;
-bool haltWaitingForInterrupt = false;
-
-void init_handlers();
-int handle_op(OpCode &opCode);
-
-std::ofstream olog;
+int handle_op(Machine &m, const OpCode &opCode);
 
-Register regAF;
-Register regBC;
-Register regDE;
-Register regHL;
-int extraCycles;
+bool idleSkip = true;
 
-Register regSP;
-ushort regPC = 0;
-int remainingTicks = 0;
-bool vbRequested = false;
-bool vbEnabled = false;
-byte intEnableFlag = 0;
-byte intRequestFlag = 0;
-bool paused = false;
-
-uint64_t totalTicks = 0;
+void push(Machine &m, ushort s) {
+    setReg16Value(m.cpu.regSP, getReg16Value(m.cpu.regSP) - 2);
+    bus::write(m, getReg16Value(m.cpu.regSP), s);
 
+    if (DEBUG) {
+        m.cpu.stack.push_back(s & 0xFF);
+        m.cpu.stack.push_back((s >> 8) & 0xFF);
+    }
+}
 
-vector<byte> THESTACK;
+void push(Machine &m, byte b) {
+    setReg16Value(m.cpu.regSP, getReg16Value(m.cpu.regSP) - 1);
+    bus::write(m, getReg16Value(m.cpu.regSP), b);
 
-void push(ushort s) {
-    setReg16Value(regSP, getReg16Value(regSP) - 2);
-    bus::write(getReg16Value(regSP), s);
-    THESTACK.push_back(s & 0xFF);
-    THESTACK.push_back((s >> 8) & 0xFF);
+    if (DEBUG) {
+        m.cpu.stack.push_back(b);
+    }
 }
 
-void push(byte b) {
-    setReg16Value(regSP, getReg16Value(regSP) - 1);
-    bus::write(getReg16Value(regSP), b);
-    THESTACK.push_back(b);
-}
+byte pop(Machine &m) {
+    byte lo = bus::read(m, getReg16Value(m.cpu.regSP));
+    setReg16Value(m.cpu.regSP, getReg16Value(m.cpu.regSP) + 1);
+
+    if (DEBUG && !m.cpu.stack.empty()) {
+        m.cpu.stack.pop_back();
+    }
 
-byte pop() {
-    byte lo = bus::read(getReg16Value(regSP));
-    setReg16Value(regSP, getReg16Value(regSP) + 1);
-    THESTACK.pop_back();
-    
     return lo;
 }
 
-ushort spop() {
-    byte lo = pop();
-    byte hi = pop();
+ushort spop(Machine &m) {
+    byte lo = pop(m);
+    byte hi = pop(m);
 
     return toShort(lo, hi);
 }
 
-uint64_t getTickCount() {
-    return totalTicks;
+void init(Machine &m) {
+    State &c = m.cpu;
+
+    c.totalTicks = 0;
+    c.stats = Stats();
+    c.idle = IdleLoop();
+    c.haltWaitingForInterrupt = false;
+    c.stopped = false;
+    c.interruptsEnabled = false;
+    c.eiCalled = false;
+    c.volatileAccess = false;
+    c.intEnableFlag = 0;
+    c.intRequestFlag = 0;
+    c.extraCycles = 0;
+    c.callSize = 0;
+    c.cameFromI = false;
+    c.stack.clear();
+
+    c.regPC = 0x100;
+    *((short *)&c.regAF) = 0x01B0;
+    *((short *)&c.regBC) = 0x0013;
+    *((short *)&c.regDE) = 0x00D8;
+    *((short *)&c.regHL) = 0x014D;
+    *((short *)&c.regSP) = 0xFFFE;
 }
 
-void init() {
-    regPC = 0x100;
-    *((short *)&regAF) = 0x01B0;
-    *((short *)&regBC) = 0x0013;
-    *((short *)&regDE) = 0x00D8;
-    *((short *)&regHL) = 0x014D;
-    *((short *)&regSP) = 0xFFFE;
-
-    init_handlers();
-
-    //olog.open("./emu.log");
+void traceInstruction(Machine &m, byte b, const OpCode &opCode) {
+    State &c = m.cpu;
+    trace::Record r;
+    r.cycles = c.totalTicks;
+    r.pc = c.regPC;
+    r.af = getReg16Value(c.regAF);
+    r.bc = getReg16Value(c.regBC);
+    r.de = getReg16Value(c.regDE);
+    r.hl = getReg16Value(c.regHL);
+    r.sp = getReg16Value(c.regSP);
+    r.opcode = b;
+    r.operands[0] = opCode.length > 1 ? bus::read(m, c.regPC + 1) : 0;
+    r.operands[1] = opCode.length > 2 ? bus::read(m, c.regPC + 2) : 0;
+    r.reserved = 0;
+
+    if (trace::enabled(m.trace)) trace::push(m.trace, r);
+
+    if (DEBUG) trace::print(cout, m.cpu.stats.instructions, r);
 }
 
-int cpuSpeed = 0;
-int n = 0;
-
-void tick() {
-    totalTicks++;
-
-    if (remainingTicks) {
-        remainingTicks--;
-        return;
+/*
+  Called after a short backward jump, with totalTicks at the start of the next
+  iteration.  Between scheduled events nothing but the CPU changes memory, so
+  if one whole iteration ran since the last event, wrote nothing, read nothing
+  that moves on its own and came back to the loop head with the same
+  registers, every iteration until the next event will do exactly the same.
+  Those are skipped in one go; the iteration the event lands in runs normally
+  so the loop exits on the same cycle it would have otherwise.
+*/
+void checkIdleLoop(Machine &m) {
+    State &c = m.cpu;
+    IdleLoop &idle = c.idle;
+
+    if (idle.armed && idle.pc == c.regPC && c.totalTicks < scheduler::next(m) && !c.volatileAccess && !c.eiCalled &&
+        idle.ime == c.interruptsEnabled &&
+        idle.af == getReg16Value(c.regAF) && idle.bc == getReg16Value(c.regBC) &&
+        idle.de == getReg16Value(c.regDE) && idle.hl == getReg16Value(c.regHL) &&
+        idle.sp == getReg16Value(c.regSP)) {
+
+        uint64_t len = c.totalTicks - idle.start;
+        uint64_t count = (scheduler::next(m) - c.totalTicks) / len;
+
+        if (count) {
+            c.stats.instructions += count * (c.stats.instructions - idle.instructions);
+            c.stats.idleLoops++;
+            c.stats.idleCycles += count * len;
+            c.totalTicks += count * len;
+        }
     }
 
-    if (!haltWaitingForInterrupt) {
-        byte b = bus::read(regPC);
+    idle.armed = true;
+    idle.pc = c.regPC;
+    idle.start = c.totalTicks;
+    idle.instructions = c.stats.instructions;
+    idle.af = getReg16Value(c.regAF);
+    idle.bc = getReg16Value(c.regBC);
+    idle.de = getReg16Value(c.regDE);
+    idle.hl = getReg16Value(c.regHL);
+    idle.sp = getReg16Value(c.regSP);
+    idle.ime = c.interruptsEnabled;
+    c.volatileAccess = false;
+}
 
-        OpCode opCode = opCodes[b];
-        n++;
-        
-        if ((n % 1000) == 0) {
-            usleep(1);
-        }
+/*
+  Runs one instruction (or one idle cycle while halted) and returns the
+  number of M-cycles it took.
+*/
+int step(Machine &m) {
+    State &c = m.cpu;
+    int cycles = 1;
+    bool backJump = false;
 
-        if (n == 0xeae8a) {
-            //paused = true;
-        }
+    if (!c.haltWaitingForInterrupt) {
+        byte b = bus::read(m, c.regPC);
+        c.stats.instructions++;
 
-        std::stringstream ss;
-        ss << Int64(n) << ": " << Short(regPC) << ": " << Byte(b) << " " << Byte(bus::read(regPC + 1)) << " " << Byte(bus::read(regPC + 2)) << " (" << std::left << std::setfill(' ') << std::setw(10) << opCode.name << ") "
-                << std::right
-                << " - AF: " << Short(toShort(regAF.lo, regAF.hi))
-                << " - BC: " << Short(toShort(regBC.lo, regBC.hi))
-                << " - DE: " << Short(toShort(regDE.lo, regDE.hi))
-                << " - HL: " << Short(toShort(regHL.lo, regHL.hi))
-                << " - SP: " << Short(toShort(regSP.lo, regSP.hi))
-                << " - Cycles: " << (totalTicks - 1)
-                << endl;
+        const OpCode &opCode = opCodes[b];
 
-        if (DEBUG) cout << ss.str();
+        if (trace::enabled(m.trace) || DEBUG) {
+            traceInstruction(m, b, opCode);
+        }
 
-        int n = handle_op(opCode);
+        ushort pc = c.regPC;
+        int n = handle_op(m, opCode);
 
-        if (opCode.value == 0xff) {
+        if (DEBUG && opCode.value == 0xff) {
             cout << "HIT FF" << endl;
             //sleep(5);
         }
 
-        regPC += opCode.length;
+        c.regPC += opCode.length;
+
+        backJump = (opCode.op == JR || opCode.op == JP) && c.regPC <= pc && pc - c.regPC < 32;
 
-        remainingTicks = ((n + opCode.cycles) / 4) - 1;
+        cycles = (n + opCode.cycles) / 4;
 
-        if (extraCycles) {
-            remainingTicks += extraCycles;
-            extraCycles = 0;
+        if (c.extraCycles) {
+            cycles += c.extraCycles;
+            c.extraCycles = 0;
         }
     }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(cpuSpeed));
-
-    if (interruptsEnabled && bus::read(0xFF0F)) {
-        handleInterrupt(bus::read(0xFF0F), true, false);
+    if (c.interruptsEnabled && (c.intEnableFlag & c.intRequestFlag & 0x1F)) {
+        handleInterrupt(m, 0, false, false);
     }
-}
 
-void handleInterrupt(byte flag, bool request, bool pcp1) {
-    if (flag & 1) {
-        if (request) vbEnabled = true; else vbRequested = true;
+    c.totalTicks += cycles;
 
-        //cout << "V-Blank " << (request ? "requested" : "enabled") << endl;
-
-        if (request) {
-            intRequestFlag = flag;
-        }
-
-        if (request && interruptsEnabled && (intEnableFlag & 1)) {
-            //cout << "CPU:> HANDLING VBLANK" << endl;
-            intRequestFlag &= ~1;
-            //cout << "Disabling VBlank: " << Byte(intRequestFlag) << endl;
+    //skipped iterations would be missing from the trace.
+    if (backJump && idleSkip && !trace::enabled(m.trace) && !DEBUG) {
+        checkIdleLoop(m);
+    }
 
-            if (pcp1) {
-                push((ushort)(regPC + 1));
-            } else {
-                push(regPC);
-            }
+    return cycles;
+}
 
-            if (haltWaitingForInterrupt) {
-                //cout << "RESUMING" << endl;
+/*
+  While halted nothing happens until an interrupt is requested (or, after
+  STOP, a joypad line goes low), and only scheduled events can do that, so
+  skip straight to the next event instead of idling one cycle at a time.
+  The events in between still run in order so no PPU lines are missed.
+*/
+void run(Machine &m) {
+    State &c = m.cpu;
+
+    //an iteration is only a safe template if no event ran during it.
+    c.idle.armed = false;
+
+    while (c.totalTicks < scheduler::next(m)) {
+        if (c.haltWaitingForInterrupt) {
+            if (!c.stopped && (c.intEnableFlag & c.intRequestFlag & 0x1F)) {
+                c.haltWaitingForInterrupt = false;
+                continue;
             }
 
-            haltWaitingForInterrupt = false;
-            regPC = 0x40;
-            interruptsEnabled = false;
-            //changePC(0x40);
-            //cpuSpeed = 500;
-        } else {
-           // cout << "DENIED" << endl;
+            c.stats.haltedCycles += scheduler::next(m) - c.totalTicks;
+            c.totalTicks = scheduler::next(m);
+            break;
         }
-    } else if (flag & 2) {
-        intRequestFlag |= flag;
 
-        if (request && interruptsEnabled && (intEnableFlag & 2)) {
-            intRequestFlag &= ~2;
-
-            if (pcp1) {
-                push((ushort)(regPC + 1));
-            } else {
-                push(regPC);
-            }
-
-            if (haltWaitingForInterrupt) {
-                //cout << "RESUMING" << endl;
-            }
+        step(m);
+    }
+}
 
-            haltWaitingForInterrupt = false;
-            regPC = 0x48;
-            interruptsEnabled = false;
-        }
-    }else if (flag & 4) {
-        intRequestFlag |= flag;
+/*
+  Sets the requested bits in IF, then with IME set services the highest
+  priority interrupt that is both requested and enabled in IE: the lowest
+  bit, VBlank at 0x40 up to joypad at 0x60.  A pending interrupt that IE
+  masks off does not hold up the others.
+*/
+void handleInterrupt(Machine &m, byte flag, bool request, bool pcp1) {
+    State &c = m.cpu;
+
+    if (request) {
+        c.intRequestFlag |= flag & 0x1F;
+    }
 
-        if (request && interruptsEnabled && (intEnableFlag & 4)) {
-            intRequestFlag &= ~4;
+    byte pending = c.intEnableFlag & c.intRequestFlag & 0x1F;
 
-            if (pcp1) {
-                push((ushort)(regPC + 1));
-            } else {
-                push(regPC);
-            }
+    if (!c.interruptsEnabled || !pending || c.stopped) {
+        return;
+    }
 
-            if (haltWaitingForInterrupt) {
-                //cout << "RESUMING" << endl;
-            }
+    int n = __builtin_ctz(pending);
+    c.intRequestFlag &= ~(1 << n);
 
-            haltWaitingForInterrupt = false;
-            regPC = 0x50;
-            interruptsEnabled = false;
-        }
-    }
-    else if (flag) {
-        cout << "OK ANOTHER INTERRUPT: " << Byte(flag) << endl;
-        sleep(10);
+    if (pcp1) {
+        push(m, (ushort)(c.regPC + 1));
     } else {
-        intRequestFlag = flag;
+        push(m, c.regPC);
     }
-}
 
+    c.haltWaitingForInterrupt = false;
+    c.regPC = 0x40 + n * 8;
+    c.interruptsEnabled = false;
+}
 
-byte getInterruptsEnableFlag() {
-    return intEnableFlag;
+byte getInterruptsEnableFlag(Machine &m) {
+    return m.cpu.intEnableFlag;
 }
-byte getInterruptsRequestsFlag() {
-    return intRequestFlag;
+byte getInterruptsRequestsFlag(Machine &m) {
+    return m.cpu.intRequestFlag;
 }
 
-void setInterruptsEnableFlag(byte f) {
-    intEnableFlag = f;
+void setInterruptsEnableFlag(Machine &m, byte f) {
+    m.cpu.intEnableFlag = f;
 }
 
-void setInterruptsRequestsFlag(byte f) {
-    intRequestFlag = f;
+void setInterruptsRequestsFlag(Machine &m, byte f) {
+    m.cpu.intRequestFlag = f;
 }
 
 
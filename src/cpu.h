@@ -1,15 +1,11 @@
 #pragma once
 
 #include "common.h"
+#include "machine.h"
 
 namespace dsemu {
 namespace cpu {
 
-struct Register {
-    byte lo;
-    byte hi;
-};
-
 /*
 
 The Zero Flag (Z)
@@ -33,7 +29,7 @@ enum Flags {
     FlagC = 4
 };
 
-enum Op {
+enum Op : byte {
     NOP,
     LD,
     LDI,
@@ -74,7 +70,7 @@ enum Op {
     HALT
 };
 
-enum AddrType {
+enum AddrType : byte {
     ATypeNA,
     ATypeRR,
     ATypeIR,
@@ -91,7 +87,7 @@ enum AddrType {
     ATypeSP
 };
 
-enum ParamType {
+enum ParamType : byte {
     A,
     B,
     C,
@@ -111,37 +107,32 @@ enum ParamType {
 };
 
 enum Interrupts {
-    IVBlank = 1
+    IVBlank = 1,
+    ILCDStat = 2,
+    ITimer = 4,
+    ISerial = 8,
+    IJoypad = 16
 };
 
 struct OpCode {
     byte value;
-    const string &name;
+    const char *name;
     Op op;
     byte length;
     byte cycles;
     AddrType mode;
-    ParamType params[4];
+    ParamType params[2];
 };
 
-extern Register regAF;
-extern Register regBC;
-extern Register regDE;
-extern Register regHL;
-extern ushort regPC;
-extern Register regSP;
-
-extern OpCode opCodes[];
+//skip whole iterations of busy-wait loops, see checkIdleLoop() in cpu.cpp.
+extern bool idleSkip;
 
-extern int extraCycles;
-extern bool haltWaitingForInterrupt;
-
-inline bool getFlag(Flags n) {
-    return getBit(regAF.lo, n);
+inline bool getFlag(Machine &m, Flags n) {
+    return getBit(m.cpu.regAF.lo, n);
 }
 
-inline void setFlag(Flags n, bool val) {
-    setBit(regAF.lo, n, val);
+inline void setFlag(Machine &m, Flags n, bool val) {
+    setBit(m.cpu.regAF.lo, n, val);
 }
 
 inline ushort *getReg16Pointer(const Register &reg) {
@@ -156,27 +147,26 @@ inline void setReg16Value(const Register &reg, ushort val) {
     *getReg16Pointer(reg) = val;
 }
 
-extern bool paused;
-
-void run();
-void handleInterrupt(byte flag, bool request, bool pcp1 = true);
-void tick();
-void init();
-void interrupt(Interrupts i);
+//runs instructions until the next scheduled event is due.
+void run(Machine &m);
+int step(Machine &m);
+void handleInterrupt(Machine &m, byte flag, bool request, bool pcp1 = true);
+void init(Machine &m);
 
-byte getInterruptsEnableFlag();
-byte getInterruptsRequestsFlag();
+byte getInterruptsEnableFlag(Machine &m);
+byte getInterruptsRequestsFlag(Machine &m);
 
-void setInterruptsEnableFlag(byte f);
-void setInterruptsRequestsFlag(byte f);
+void setInterruptsEnableFlag(Machine &m, byte f);
+void setInterruptsRequestsFlag(Machine &m, byte f);
 
-uint64_t getTickCount();
-void changePC(ushort address);
+inline uint64_t getTickCount(const Machine &m) {
+    return m.cpu.totalTicks;
+}
 
-byte pop();
-ushort spop();
-void push(byte);
-void push(ushort);
+byte pop(Machine &m);
+ushort spop(Machine &m);
+void push(Machine &m, byte);
+void push(Machine &m, ushort);
 
 }
 }
@@ -0,0 +1,125 @@
+#include "dsemu.h"
+#include "common.h"
+#include "emu.h"
+#include "cart.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "bus.h"
+#include "memory.h"
+#include "input.h"
+
+#include <cstring>
+
+using namespace dsemu;
+
+//nothing paces these, ppu.onFrame is left unset.
+struct dsemu_emu {
+    Machine *m;
+    bool loaded;
+    const uint32_t *frame;
+};
+
+//a clean machine around whatever cart::load just put in place.
+static void reset(dsemu_emu *emu) {
+    std::memset(emu->m->ram, 0, sizeof(emu->m->ram));
+    dsemu::init(*emu->m);
+
+    emu->loaded = true;
+    emu->frame = nullptr;
+}
+
+dsemu_emu *dsemu_create(void) {
+    //the host owns stdout.
+    cart::verbose = false;
+
+    dsemu_emu *emu = new dsemu_emu();
+    emu->m = new Machine();
+
+    return emu;
+}
+
+void dsemu_destroy(dsemu_emu *emu) {
+    if (emu == nullptr) {
+        return;
+    }
+
+    cart::unload(*emu->m);
+
+    delete emu->m;
+    delete emu;
+}
+
+int dsemu_load_rom(dsemu_emu *emu, const char *path) {
+    return dsemu_load_rom_with_save(emu, path, nullptr);
+}
+
+int dsemu_load_rom_with_save(dsemu_emu *emu, const char *path, const char *save_path) {
+    if (!cart::load(*emu->m, string(path), save_path ? string(save_path) : "")) {
+        emu->loaded = false;
+        return -1;
+    }
+
+    reset(emu);
+    return 0;
+}
+
+int dsemu_load_rom_buffer(dsemu_emu *emu, const void *data, size_t size) {
+    if (size > INT32_MAX || !cart::load(*emu->m, (const byte *)data, (int)size)) {
+        emu->loaded = false;
+        return -1;
+    }
+
+    reset(emu);
+    return 0;
+}
+
+uint64_t dsemu_run_frames(dsemu_emu *emu, int frames) {
+    return emu->loaded && frames > 0 ? runFrames(*emu->m, frames) : 0;
+}
+
+uint64_t dsemu_run_cycles(dsemu_emu *emu, uint64_t cycles) {
+    return emu->loaded && cycles > 0 ? runCycles(*emu->m, cycles) : 0;
+}
+
+uint64_t dsemu_cycles(const dsemu_emu *emu) {
+    return cpu::getTickCount(*emu->m);
+}
+
+uint64_t dsemu_frames(const dsemu_emu *emu) {
+    return emu->m->ppu.currentFrame;
+}
+
+const uint32_t *dsemu_framebuffer(dsemu_emu *emu) {
+    if (const uint32_t *frame = ppu::takeFrame(*emu->m)) {
+        emu->frame = frame;
+    }
+
+    return emu->frame ? emu->frame : emu->m->ppu.videoBuffer;
+}
+
+void dsemu_set_render_interval(dsemu_emu *emu, int interval) {
+    ppu::setRenderInterval(*emu->m, interval);
+}
+
+void dsemu_set_buttons(dsemu_emu *emu, uint8_t buttons) {
+    input::set(*emu->m, buttons);
+}
+
+uint8_t *dsemu_memory(dsemu_emu *emu, size_t *size) {
+    if (size) {
+        *size = sizeof(emu->m->ram);
+    }
+
+    return emu->m->ram;
+}
+
+//the bus has no page table until a ROM is loaded.
+uint8_t dsemu_read(dsemu_emu *emu, uint16_t address) {
+    return emu->loaded ? bus::read(*emu->m, address) : 0xFF;
+}
+
+void dsemu_write(dsemu_emu *emu, uint16_t address, uint8_t value) {
+    if (emu->loaded) {
+        bus::write(*emu->m, address, (byte)value);
+    }
+}
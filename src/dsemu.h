@@ -0,0 +1,149 @@
+#ifndef DSEMU_H
+#define DSEMU_H
+
+/*
+  C API for embedding the emulator.
+
+  Everything runs on the calling thread: dsemu_run_frames() and
+  dsemu_run_cycles() return once the work is done, there is no pacing and no
+  window.  Pointers handed out point straight at the emulator's memory and
+  stay valid until dsemu_destroy(), the framebuffer's contents until the
+  next run call.
+
+  Emulators are independent of each other, any number of them can exist and
+  each can be driven from its own thread.  One emulator must only be used
+  by one thread at a time.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dsemu_emu dsemu_emu;
+
+/* bits for dsemu_set_buttons() */
+enum {
+    DSEMU_BUTTON_RIGHT  = 1 << 0,
+    DSEMU_BUTTON_LEFT   = 1 << 1,
+    DSEMU_BUTTON_UP     = 1 << 2,
+    DSEMU_BUTTON_DOWN   = 1 << 3,
+    DSEMU_BUTTON_A      = 1 << 4,
+    DSEMU_BUTTON_B      = 1 << 5,
+    DSEMU_BUTTON_SELECT = 1 << 6,
+    DSEMU_BUTTON_START  = 1 << 7
+};
+
+enum {
+    DSEMU_WIDTH = 160,
+    DSEMU_HEIGHT = 144
+};
+
+dsemu_emu *dsemu_create(void);
+void dsemu_destroy(dsemu_emu *emu);
+
+/*
+  All three reset the machine, 0 on success, -1 if the ROM cannot be read or
+  its mapper is not supported.  Battery RAM is not saved anywhere unless
+  dsemu_load_rom_with_save() is given a file for it, which is then mapped
+  shared: emulators must not use the same one at the same time.
+*/
+int dsemu_load_rom(dsemu_emu *emu, const char *path);
+int dsemu_load_rom_with_save(dsemu_emu *emu, const char *path, const char *save_path);
+int dsemu_load_rom_buffer(dsemu_emu *emu, const void *data, size_t size);
+
+/* return the number of cycles (1 MiHz M-cycles) that were run. */
+uint64_t dsemu_run_frames(dsemu_emu *emu, int frames);
+uint64_t dsemu_run_cycles(dsemu_emu *emu, uint64_t cycles);
+
+uint64_t dsemu_cycles(const dsemu_emu *emu);
+uint64_t dsemu_frames(const dsemu_emu *emu);
+
+/* last finished frame, DSEMU_WIDTH x DSEMU_HEIGHT ARGB8888 pixels. */
+const uint32_t *dsemu_framebuffer(dsemu_emu *emu);
+
+/* draw every nth frame, 1 (the default) draws all of them and 0 none. */
+void dsemu_set_render_interval(dsemu_emu *emu, int interval);
+
+/* held buttons, DSEMU_BUTTON_* bits.  Takes effect immediately. */
+void dsemu_set_buttons(dsemu_emu *emu, uint8_t buttons);
+
+/*
+  The 64KB backing store of the address space, VRAM, WRAM and HRAM are at
+  their addresses.  Banked ROM and cart RAM, OAM and the I/O registers are
+  not reliably in it: dsemu_read() and dsemu_write() go through the bus
+  like the CPU does and see everything.  Until a ROM is loaded
+  dsemu_read() returns 0xFF and dsemu_write() does nothing.
+*/
+uint8_t *dsemu_memory(dsemu_emu *emu, size_t *size);
+uint8_t dsemu_read(dsemu_emu *emu, uint16_t address);
+void dsemu_write(dsemu_emu *emu, uint16_t address, uint8_t value);
+
+/*
+  Vector environments.
+
+  A dsemu_vec is count emulators running the same ROM, stepped together a
+  number of frames per call.  Their observations live in one buffer the
+  caller owns: instance i has the slot at i * dsemu_vec_stride(), the frame
+  first, then one byte per requested address.  The PPU draws straight into
+  the slots, so there is nothing to copy out; only the RAM bytes are read
+  after each step.  Slots are whole cache lines apart.
+
+  The buffer can be shared with another process: dsemu_shm_map() creates or
+  opens a POSIX shared memory object (a name like "/envs") and maps it.
+
+  With threads > 1 the instances are split into that many fixed groups and
+  each step runs them in parallel, the calling thread takes one group.
+  Every instance gives the same results whatever the thread count.
+*/
+
+typedef struct dsemu_vec dsemu_vec;
+
+/* what goes at the start of each slot */
+enum {
+    DSEMU_OBS_ARGB,     /* DSEMU_WIDTH x DSEMU_HEIGHT ARGB8888 pixels */
+    DSEMU_OBS_INDEX,    /* one byte per pixel, the shade 0 (lightest) to 3 */
+    DSEMU_OBS_NONE      /* no frame, nothing is drawn */
+};
+
+typedef struct {
+    int count;
+    int observation;            /* DSEMU_OBS_* */
+    const uint16_t *ram;        /* addresses read into each slot after a step */
+    int ram_count;
+    int threads;                /* 0 or 1 steps everything on the calling thread */
+} dsemu_vec_config;
+
+/* bytes per slot, the buffer needs count times this. */
+size_t dsemu_vec_stride(const dsemu_vec_config *config);
+
+/* null if the config is invalid, or the buffer too small or (for ARGB) not 4 byte aligned. */
+dsemu_vec *dsemu_vec_create(const dsemu_vec_config *config, void *buffer, size_t size);
+void dsemu_vec_destroy(dsemu_vec *vec);
+
+/* loads the ROM into every instance and resets them all, 0 on success, -1 as dsemu_load_rom(). */
+int dsemu_vec_load_rom(dsemu_vec *vec, const char *path);
+
+/* resets one instance to power on, e.g. at the end of an episode. */
+void dsemu_vec_reset(dsemu_vec *vec, int index);
+
+/*
+  Holds buttons[i] (DSEMU_BUTTON_* bits) on instance i, or keeps what is held
+  if buttons is null, and runs every instance frames frames.  Only the last
+  one is drawn.  When it returns every slot holds that frame and the RAM
+  bytes as they are at its VBlank.  Returns the cycles run, summed.
+*/
+uint64_t dsemu_vec_step(dsemu_vec *vec, const uint8_t *buttons, int frames);
+
+/* size bytes of shared memory, created (and sized) if create is set. */
+void *dsemu_shm_map(const char *name, size_t size, int create);
+void dsemu_shm_unmap(void *memory, size_t size);
+int dsemu_shm_unlink(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
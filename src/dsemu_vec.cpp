@@ -0,0 +1,307 @@
+#include "dsemu.h"
+#include "common.h"
+#include "emu.h"
+#include "cart.h"
+#include "ppu.h"
+#include "bus.h"
+#include "input.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace dsemu;
+
+/*
+  The vector environment behind dsemu_vec_*.
+
+  Each instance's PPU target is its slot in the caller's buffer, so a step
+  leaves the frames where the consumer reads them.  Instances are split into
+  fixed groups, one per thread, and a step wakes the pool, runs group 0 on
+  the calling thread and waits for the rest.  An instance always runs on
+  the same thread, and nothing is shared between them but the ROM image.
+*/
+
+const size_t SLOT_ALIGN = 64;
+
+struct dsemu_vec {
+    int count;
+    int observation;
+    std::vector<ushort> ram;
+    byte *buffer;
+    size_t stride;
+    size_t frameSize;
+
+    std::vector<Machine *> machines;
+    bool loaded;
+
+    //the step the pool is working on.
+    const uint8_t *buttons;
+    int frames;
+    std::vector<uint64_t> cycles;
+
+    int groups;
+    std::vector<std::thread> pool;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation;
+    int pending;
+    bool quit;
+};
+
+static size_t frameSize(int observation) {
+    switch (observation) {
+        case DSEMU_OBS_ARGB: return ppu::XRES * ppu::YRES * sizeof(uint32_t);
+        case DSEMU_OBS_INDEX: return ppu::XRES * ppu::YRES;
+        default: return 0;
+    }
+}
+
+static byte *slot(dsemu_vec *vec, int i) {
+    return vec->buffer + i * vec->stride;
+}
+
+//power on, with whatever cart::load() or cart::reset() left.
+static void reset(dsemu_vec *vec, int i) {
+    Machine &m = *vec->machines[i];
+
+    std::memset(m.ram, 0, sizeof(m.ram));
+    dsemu::init(m);
+}
+
+static uint64_t stepOne(dsemu_vec *vec, int i) {
+    Machine &m = *vec->machines[i];
+    uint64_t cycles = 0;
+
+    if (vec->buttons) {
+        input::set(m, vec->buttons[i]);
+    }
+
+    //only the frame the step ends on is looked at.
+    if (vec->frames > 1) {
+        ppu::setRenderInterval(m, 0);
+        cycles += runFrames(m, vec->frames - 1);
+    }
+
+    ppu::setRenderInterval(m, vec->observation == DSEMU_OBS_NONE ? 0 : 1);
+    cycles += runFrames(m, 1);
+
+    byte *out = slot(vec, i) + vec->frameSize;
+
+    for (size_t j=0; j<vec->ram.size(); j++) {
+        out[j] = bus::read(m, vec->ram[j]);
+    }
+
+    return cycles;
+}
+
+static uint64_t stepGroup(dsemu_vec *vec, int group) {
+    int first = (int64_t)vec->count * group / vec->groups;
+    int last = (int64_t)vec->count * (group + 1) / vec->groups;
+    uint64_t cycles = 0;
+
+    for (int i=first; i<last; i++) {
+        cycles += stepOne(vec, i);
+    }
+
+    return cycles;
+}
+
+static void work(dsemu_vec *vec, int group) {
+    uint64_t seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(vec->lock);
+            vec->wake.wait(lock, [&] { return vec->quit || vec->generation != seen; });
+
+            if (vec->quit) {
+                return;
+            }
+
+            seen = vec->generation;
+        }
+
+        uint64_t cycles = stepGroup(vec, group);
+
+        std::lock_guard<std::mutex> lock(vec->lock);
+        vec->cycles[group] = cycles;
+
+        if (--vec->pending == 0) {
+            vec->done.notify_one();
+        }
+    }
+}
+
+static bool valid(const dsemu_vec_config *config) {
+    return config && config->count > 0 && config->ram_count >= 0
+        && config->observation >= DSEMU_OBS_ARGB && config->observation <= DSEMU_OBS_NONE
+        && (config->ram || config->ram_count == 0);
+}
+
+size_t dsemu_vec_stride(const dsemu_vec_config *config) {
+    if (!valid(config)) {
+        return 0;
+    }
+
+    size_t size = frameSize(config->observation) + config->ram_count;
+
+    return (size + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+}
+
+dsemu_vec *dsemu_vec_create(const dsemu_vec_config *config, void *buffer, size_t size) {
+    size_t stride = dsemu_vec_stride(config);
+
+    if (!valid(config) || (stride && (!buffer || size / stride < (size_t)config->count))) {
+        return nullptr;
+    }
+
+    if (config->observation == DSEMU_OBS_ARGB && (uintptr_t)buffer % sizeof(uint32_t)) {
+        return nullptr;
+    }
+
+    //the host owns stdout.
+    cart::verbose = false;
+
+    dsemu_vec *vec = new dsemu_vec();
+    vec->count = config->count;
+    vec->observation = config->observation;
+    vec->ram.assign(config->ram, config->ram + config->ram_count);
+    vec->buffer = (byte *)buffer;
+    vec->stride = stride;
+    vec->frameSize = frameSize(config->observation);
+
+    for (int i=0; i<vec->count; i++) {
+        Machine *m = new Machine();
+
+        if (vec->observation != DSEMU_OBS_NONE) {
+            ppu::setTarget(*m, slot(vec, i), vec->observation == DSEMU_OBS_INDEX ? ppu::FormatIndex : ppu::FormatARGB);
+        }
+
+        vec->machines.push_back(m);
+    }
+
+    vec->groups = std::max(1, std::min(config->threads, vec->count));
+    vec->cycles.assign(vec->groups, 0);
+
+    for (int g=1; g<vec->groups; g++) {
+        vec->pool.emplace_back(work, vec, g);
+    }
+
+    return vec;
+}
+
+void dsemu_vec_destroy(dsemu_vec *vec) {
+    if (vec == nullptr) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(vec->lock);
+        vec->quit = true;
+    }
+
+    vec->wake.notify_all();
+
+    for (std::thread &t : vec->pool) {
+        t.join();
+    }
+
+    for (Machine *m : vec->machines) {
+        cart::unload(*m);
+        delete m;
+    }
+
+    delete vec;
+}
+
+int dsemu_vec_load_rom(dsemu_vec *vec, const char *path) {
+    vec->loaded = false;
+
+    //instances share the mapped image, only the first load reads the file.
+    for (int i=0; i<vec->count; i++) {
+        if (!cart::load(*vec->machines[i], string(path), "")) {
+            return -1;
+        }
+
+        reset(vec, i);
+    }
+
+    vec->loaded = true;
+    return 0;
+}
+
+void dsemu_vec_reset(dsemu_vec *vec, int index) {
+    if (!vec->loaded || index < 0 || index >= vec->count) {
+        return;
+    }
+
+    cart::reset(*vec->machines[index]);
+    reset(vec, index);
+}
+
+uint64_t dsemu_vec_step(dsemu_vec *vec, const uint8_t *buttons, int frames) {
+    if (!vec->loaded || frames <= 0) {
+        return 0;
+    }
+
+    vec->buttons = buttons;
+    vec->frames = frames;
+
+    if (vec->groups > 1) {
+        {
+            std::lock_guard<std::mutex> lock(vec->lock);
+            vec->generation++;
+            vec->pending = vec->groups - 1;
+        }
+
+        vec->wake.notify_all();
+    }
+
+    uint64_t cycles = stepGroup(vec, 0);
+
+    if (vec->groups > 1) {
+        std::unique_lock<std::mutex> lock(vec->lock);
+        vec->done.wait(lock, [&] { return vec->pending == 0; });
+
+        for (int g=1; g<vec->groups; g++) {
+            cycles += vec->cycles[g];
+        }
+    }
+
+    return cycles;
+}
+
+void *dsemu_shm_map(const char *name, size_t size, int create) {
+    int fd = shm_open(name, create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    if (create && ftruncate(fd, size) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+void dsemu_shm_unmap(void *memory, size_t size) {
+    if (memory) {
+        munmap(memory, size);
+    }
+}
+
+int dsemu_shm_unlink(const char *name) {
+    return shm_unlink(name);
+}
@@ -4,24 +4,65 @@
 #include "cpu.h"
 #include "bus.h"
 #include "io.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "pacer.h"
+#include "input.h"
 
 bool DEBUG = false;
 
 namespace dsemu {
 
-void run() {
-    io::init();
-    cpu::init();
-    ppu::init();
+//EventHost only has to make the CPU stop, there is nothing to do.
+static void hostStop(Machine &m, uint64_t when) {
+}
 
-    while(true) {
-        if (cpu::paused) {
-            sleepMs(1); //500);
-            continue;
-        }
+void init(Machine &m) {
+    scheduler::init(m);
+    bus::init(m);
+    io::init(m);
+    cpu::init(m);
+    ppu::init(m);
+    timer::init(m);
+    input::init(m);
+
+    scheduler::setHandler(m, scheduler::EventHost, hostStop);
+}
+
+void runToNextEvent(Machine &m) {
+    cpu::run(m);
+    scheduler::runDue(m, cpu::getTickCount(m));
+}
+
+uint64_t runFrames(Machine &m, int n) {
+    uint64_t start = cpu::getTickCount(m);
+    int target = m.ppu.currentFrame + n;
 
-        cpu::tick();
-        ppu::tick();
+    while (m.ppu.currentFrame < target) {
+        runToNextEvent(m);
+    }
+
+    return cpu::getTickCount(m) - start;
+}
+
+uint64_t runCycles(Machine &m, uint64_t n) {
+    uint64_t start = cpu::getTickCount(m);
+
+    scheduler::add(m, scheduler::EventHost, start + n);
+
+    while (cpu::getTickCount(m) < start + n) {
+        runToNextEvent(m);
+    }
+
+    return cpu::getTickCount(m) - start;
+}
+
+void run(Machine &m) {
+    init(m);
+
+    while(true) {
+        pacer::waitWhilePaused();
+        runToNextEvent(m);
     }
 }
 
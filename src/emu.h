@@ -1,9 +1,21 @@
 #pragma once
 
 #include "common.h"
+#include "machine.h"
 
 namespace dsemu {
 
-void run();
+void init(Machine &m);
+
+//run the CPU up to the next scheduled event and dispatch everything that is due.
+void runToNextEvent(Machine &m);
+
+void run(Machine &m);
+
+//run until n more frames have finished, returns the cycles that took.
+uint64_t runFrames(Machine &m, int n);
+
+//run at least n cycles, stopping at the first instruction boundary after them.
+uint64_t runCycles(Machine &m, uint64_t n);
 
 }
@@ -0,0 +1,114 @@
+#include "cpu.h"
+#include "memory.h"
+#include "cart.h"
+#include "emu.h"
+#include "ppu.h"
+#include "trace.h"
+#include "pacer.h"
+
+#include <cstring>
+#include <fstream>
+
+using namespace dsemu;
+
+/*
+  Runs a ROM without a window, for batch hosts and containers that have no
+  SDL or display.  Unthrottled unless --speed says otherwise.
+*/
+
+//binary PPM of the last finished frame.
+static bool writeFrame(const string &file, const uint32_t *frame) {
+    std::ofstream out(file, std::ios::binary);
+
+    if (!out) {
+        return false;
+    }
+
+    out << "P6\n" << ppu::XRES << " " << ppu::YRES << "\n255\n";
+
+    for (int i=0; i<ppu::XRES * ppu::YRES; i++) {
+        uint32_t c = frame[i];
+        char rgb[3] = {(char)(c >> 16), (char)(c >> 8), (char)c};
+        out.write(rgb, 3);
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    string romFile;
+    string traceFile;
+    string screenshot;
+    uint64_t traceSize = 1 << 20;
+    int frames = 0;
+
+    Machine *m = new Machine();
+    m->ppu.onFrame = pacer::frame;
+
+    pacer::setMode(pacer::ModeUnthrottled);
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (arg == "--screenshot" && i + 1 < argc) {
+            screenshot = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else if (arg == "--trace-size" && i + 1 < argc) {
+            traceSize = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--render-every" && i + 1 < argc) {
+            ppu::setRenderInterval(*m, atoi(argv[++i]));
+        } else if (arg == "--speed" && i + 1 < argc) {
+            if (!pacer::parse(argv[++i])) {
+                cout << "Unknown speed: " << argv[i] << endl;
+                return -1;
+            }
+        } else if (arg == "--prefetch") {
+            cart::prefetchROM = true;
+        } else {
+            romFile = arg;
+        }
+    }
+
+    if (romFile.empty()) {
+        cout << "Usage: emu-headless [--frames N] [--screenshot out.ppm] [--speed S] rom.gb" << endl;
+        return -1;
+    }
+
+    //nothing looks at the frames unless a screenshot is wanted.
+    if (screenshot.empty()) {
+        ppu::setRenderInterval(*m, 0);
+    }
+
+    if (!traceFile.empty()) {
+        trace::enable(m->trace, traceSize);
+        trace::dumpOnExit(m->trace, traceFile);
+    }
+
+    if (!cart::load(*m, romFile)) {
+        return -1;
+    }
+
+    //run() never returns, so without --frames this goes on until killed.
+    if (frames == 0) {
+        run(*m);
+    }
+
+    dsemu::init(*m);
+    runFrames(*m, frames);
+
+    cout << "Frames: " << m->ppu.currentFrame << " - Cycles: " << cpu::getTickCount(*m) << endl;
+
+    if (!screenshot.empty()) {
+        const uint32_t *frame = ppu::takeFrame(*m);
+
+        if (!frame || !writeFrame(screenshot, frame)) {
+            cout << "Could not write " << screenshot << endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
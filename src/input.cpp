@@ -0,0 +1,67 @@
+#include "input.h"
+#include "io.h"
+#include "scheduler.h"
+
+namespace dsemu::input {
+
+bool push(Machine &m, Button b, bool pressed, uint64_t cycle) {
+    State &in = m.input;
+    uint32_t t = in.tail.load(std::memory_order_relaxed);
+
+    if (t - in.head.load(std::memory_order_acquire) == QUEUE_SIZE) {
+        return false;
+    }
+
+    in.queue[t % QUEUE_SIZE] = {cycle, b, pressed};
+    in.tail.store(t + 1, std::memory_order_release);
+
+    return true;
+}
+
+void set(Machine &m, byte mask) {
+    byte before = io::joypadLines(m);
+
+    m.input.held = mask;
+    io::joypadChanged(m, before);
+}
+
+static void apply(Machine &m, const Event &e) {
+    byte held = m.input.held;
+    set(m, e.pressed ? held | (1 << e.button) : held & ~(1 << e.button));
+}
+
+//apply everything due by now, in queue order, and schedule the next one.
+static void applyDue(Machine &m, uint64_t now) {
+    State &in = m.input;
+    uint32_t h = in.head.load(std::memory_order_relaxed);
+
+    while (h != in.tail.load(std::memory_order_acquire)) {
+        const Event &e = in.queue[h % QUEUE_SIZE];
+
+        if (e.cycle > now) {
+            scheduler::add(m, scheduler::EventInput, e.cycle);
+            return;
+        }
+
+        apply(m, e);
+        in.head.store(++h, std::memory_order_release);
+    }
+}
+
+void init(Machine &m) {
+    m.input.held = 0;
+    scheduler::setHandler(m, scheduler::EventInput, applyDue);
+}
+
+void frameStart(Machine &m, uint64_t now) {
+    //a stamped event is already scheduled, it keeps its place.
+    if (scheduler::pending(m, scheduler::EventInput) == scheduler::NEVER) {
+        applyDue(m, now);
+    }
+}
+
+byte pressed(Machine &m) {
+    return m.input.held;
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+/*
+  Joypad input.
+
+  Frontends push button changes into a single producer, single consumer
+  lock free queue, stamped with the cycle they should happen at.  The core
+  only looks at the queue at frame start (VBlank): events that are due are
+  applied then, a later stamp is applied by a scheduler event on exactly
+  that cycle.  So input never lands in the middle of an instruction, the
+  latency is at most a frame, and a run given the same stamped events is
+  the same every time.
+*/
+
+namespace dsemu::input {
+
+//bit numbers in pressed(): the P1 direction lines, then the button lines.
+enum Button : byte {
+    ButtonRight,
+    ButtonLeft,
+    ButtonUp,
+    ButtonDown,
+    ButtonA,
+    ButtonB,
+    ButtonSelect,
+    ButtonStart,
+    ButtonCount
+};
+
+//stamp for "at the next frame start".
+const uint64_t NEXT_FRAME = 0;
+
+//producer side, one thread.  False if the queue is full.
+bool push(Machine &m, Button b, bool pressed, uint64_t cycle = NEXT_FRAME);
+
+//emulator side.
+void init(Machine &m);
+void frameStart(Machine &m, uint64_t now);
+
+//emulator thread only: hold exactly the buttons in mask right away, at an
+//instruction boundary, without going through the queue.
+void set(Machine &m, byte mask);
+
+//one bit per Button that is held.
+byte pressed(Machine &m);
+
+}
@@ -3,210 +3,218 @@
 #include "cpu.h"
 #include "memory.h"
 #include "bus.h"
+#include "timer.h"
+#include "input.h"
 
-#include <map>
-#include <unistd.h>
 
 namespace dsemu::io {
 
-typedef byte (*IO_READ_HANDLER)();
-typedef void (*IO_WRITE_HANDLER)(byte b);
+/*
+  Bits that always read back as 1 on a DMG, for the registers without a read
+  handler.  Unmapped registers read as 0xFF.
+*/
+constexpr byte readMasks[0x80] = {
+    //FF00: P1, SB, SC, -, DIV, TIMA, TMA, TAC, -, -, -, -, -, -, -, IF
+    0xC0, 0x00, 0x7E, 0xFF, 0x00, 0x00, 0x00, 0xF8, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xE0,
+    //FF10: sound channels 1 and 2
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF, 0x9F, 0xFF, 0xBF, 0xFF,
+    //FF20: sound channel 4 and control
+    0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x70, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    //FF30: wave RAM
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    //FF40: LCD
+    0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+byte joypadLines(Machine &m) {
+    byte held = input::pressed(m);
+    byte lines = 0x0F;
+
+    if (!m.io.selDirs) {
+        lines &= ~(held & 0x0F);
+    }
+
+    if (!m.io.selButtons) {
+        lines &= ~(held >> 4);
+    }
 
-typedef std::map<ushort, std::pair<IO_READ_HANDLER, IO_WRITE_HANDLER>> HANDLER_MAP;
+    return lines;
+}
 
-HANDLER_MAP handlerMap;
+//the interrupt fires when any P1 input line goes from high to low, which
+//also ends STOP.
+void joypadChanged(Machine &m, byte before) {
+    if (before & ~joypadLines(m) & 0x0F) {
+        if (m.cpu.stopped) {
+            m.cpu.stopped = false;
+            m.cpu.haltWaitingForInterrupt = false;
+        }
 
-byte readScrollX() {
-    return ppu::getXScroll();
+        cpu::handleInterrupt(m, cpu::IJoypad, true, false);
+    }
 }
 
-void writeScrollX(byte b) {
-    ppu::setXScroll(b);
+byte readJoypad(Machine &m) {
+    m.cpu.volatileAccess = true;
+
+    return 0xC0 | m.io.selButtons | m.io.selDirs | joypadLines(m);
 }
 
-byte readLCDStats() {
-    return ppu::lcdStats;
+void writeJoypad(Machine &m, byte b) {
+    byte before = joypadLines(m);
+
+    m.io.selButtons = b & 0x20;
+    m.io.selDirs = b & 0x10;
+
+    joypadChanged(m, before);
 }
 
-void writeLCDStats(byte b) {
-    ppu::lcdStats = b;
+//there is never a link partner, so a transfer finishes at once and shifts in 0xFF.
+void writeSerialControl(Machine &m, byte b) {
+    if (b & 0x80) {
+        if (m.io.onSerial) {
+            m.io.onSerial(m, m.ram[0xFF01]);
+        }
+
+        m.ram[0xFF01] = 0xFF;
+        b &= ~0x80;
+    }
+
+    m.ram[0xFF02] = b;
 }
 
-byte readLCDControl() {
-    return ppu::lcdControl;
+byte readInterruptRequests(Machine &m) {
+    return cpu::getInterruptsRequestsFlag(m) | 0xE0;
 }
 
-void writeLCDControl(byte b) {
-    ppu::lcdControl = b;
+void writeInterruptRequests(Machine &m, byte b) {
+    cpu::setInterruptsRequestsFlag(m, b & 0x1F);
 }
 
-void writeDMA(byte b) {
-    for (int i=0; i<0xA0; i++) {
-        byte d = bus::read((b * 0x100) + i);
-        bus::write(0xFE00 + i, d);
-    }
+byte readScrollX(Machine &m) {
+    return ppu::getXScroll(m);
+}
 
-    cpu::extraCycles = 0;
+void writeScrollX(Machine &m, byte b) {
+    ppu::sync(m);
+    ppu::setXScroll(m, b);
 }
 
-byte readDMS() {
-    return 0;
+void writeScrollY(Machine &m, byte b) {
+    ppu::sync(m);
+    ppu::setYScroll(m, b);
 }
 
-#define ADD_MEMORY_HANDLER(X) handlerMap[X] = std::make_pair([]() -> byte { if (X < 0x8000) { cout << "OOPS OOB" << endl; sleep(10); } return memory::read(X); }, [](byte b) -> void { memory::write(X, b); });
+//palettes and window position, only the pixel FIFO needs to see these change.
+template<ushort ADDRESS>
+void writePPURegister(Machine &m, byte b) {
+    ppu::sync(m);
+    m.ram[ADDRESS] = b;
+}
 
-void init() {
-    IO_WRITE_HANDLER noWrite = [](byte b) -> void { };
+byte readLCDStats(Machine &m) {
+    return m.ppu.lcdStats | 0x80;
+}
 
-    handlerMap[0xFF43] = std::make_pair(readScrollX, writeScrollX);
-    handlerMap[0xFF42] = std::make_pair(ppu::getYScroll, ppu::setYScroll);
-    handlerMap[0xFF40] = std::make_pair(readLCDControl, writeLCDControl);
-    handlerMap[0xFF41] = std::make_pair(readLCDStats, writeLCDStats);
-    handlerMap[0xFF44] = std::make_pair(ppu::getCurrentLine, noWrite);
-    handlerMap[0xFF46] = std::make_pair(readDMS, writeDMA);
+//the mode and LY=LYC bits are read only.
+void writeLCDStats(Machine &m, byte b) {
+    m.ppu.lcdStats = (b & 0x78) | (m.ppu.lcdStats & 0x07);
+    ppu::checkLYC(m);
+}
 
-    ADD_MEMORY_HANDLER(0xFF45);
-    ADD_MEMORY_HANDLER(0xFF47);
-    ADD_MEMORY_HANDLER(0xFF48);
-    ADD_MEMORY_HANDLER(0xFF49);
+byte readLYC(Machine &m) {
+    return m.ram[0xFF45];
 }
 
-bool startDown = false;
-bool aDown = false;
-bool selectDown = false;
-bool rightDown = false;
-bool leftDown = false;
-bool upDown = false;
-bool downDown = false;
+void writeLYC(Machine &m, byte b) {
+    m.ram[0xFF45] = b;
+    ppu::checkLYC(m);
+}
 
-byte selButtons = 0;
-byte selDirs = 0;
+byte readLCDControl(Machine &m) {
+    return m.ppu.lcdControl;
+}
 
-byte read(ushort address) {
+void writeLCDControl(Machine &m, byte b) {
+    ppu::sync(m);
+    m.ppu.lcdControl = b;
+}
 
-    HANDLER_MAP::iterator it = handlerMap.find(address);
-    
-    if (it != handlerMap.end()) {
-        return it->second.first();
+void writeDMA(Machine &m, byte b) {
+    for (int i=0; i<0xA0; i++) {
+        byte d = bus::read(m, (b * 0x100) + i);
+        bus::write(m, 0xFE00 + i, d);
     }
 
-    if (address == 0xFF00) {
-        byte output = 0xCF;
+    m.cpu.extraCycles = 0;
+}
 
+byte readDMA(Machine &m) {
+    return 0;
+}
 
-        if (!selButtons) {
-            if (startDown) {
-                output &= ~(1 << 3);
-            } else if (selectDown) {
-                output &= ~(1 << 2);
-            } else if (aDown) {
-                output &= ~(1 << 0);
-            }
-        }
+void noWrite(Machine &m, byte b) {
+}
 
-        if (!selDirs) {
-            if (leftDown) {
-                output &= ~(1 << 1);
-            } else if (rightDown) {
-                output &= ~(1 << 0);
-            } else if (upDown) {
-                output &= ~(1 << 2);
-            } else if (downDown) {
-                output &= ~(1 << 3);
-            }
-        }
+void addHandler(Machine &m, ushort address, IO_READ_HANDLER r, IO_WRITE_HANDLER w) {
+    m.io.readHandlers[address - 0xFF00] = r;
+    m.io.writeHandlers[address - 0xFF00] = w;
+}
 
-        return output; //0xC0 | (0xF^moreBit) | (selDirs | selButtons);
-    } else if (address == 0xFF01) {
-        //cout << endl << "SERIAL READ: " << endl;
-        //sleep(2);
-        return 0;
-    } else if (address == 0xFF02) {
-        //cout << endl << "SERIAL IO: " << endl;
-        //sleep(2);
-        return 0;
-    } else if (address == 0xFF03) {
-        //cout << endl << "DIV IO: " << endl;
-        //sleep(2);
-        return 0;
-    } else if (address == 0xFF04) {
-        //cout << endl << "TIMA IO: " << endl;
-        //sleep(2);
-        return 0;
-    } else if (address == 0xFF44) {
-        return (byte)ppu::getCurrentLine();
-        //cout << endl << "READ LCD: " << endl;
-        //sleep(2);
-    } else if (address == 0xFF0F) {
-        return cpu::getInterruptsRequestsFlag();
-    } else if (address == 0xFFFF) {
-        return cpu::getInterruptsEnableFlag();
+void init(Machine &m) {
+    //the serial hook belongs to the host.
+    SERIAL_HANDLER onSerial = m.io.onSerial;
+    m.io = State();
+    m.io.onSerial = onSerial;
+
+    addHandler(m, 0xFF00, readJoypad, writeJoypad);
+    addHandler(m, 0xFF02, nullptr, writeSerialControl);
+
+    addHandler(m, 0xFF04, timer::readDIV, timer::writeDIV);
+    addHandler(m, 0xFF05, timer::readTIMA, timer::writeTIMA);
+    addHandler(m, 0xFF06, timer::readTMA, timer::writeTMA);
+    addHandler(m, 0xFF07, timer::readTAC, timer::writeTAC);
+    addHandler(m, 0xFF0F, readInterruptRequests, writeInterruptRequests);
+
+    addHandler(m, 0xFF40, readLCDControl, writeLCDControl);
+    addHandler(m, 0xFF41, readLCDStats, writeLCDStats);
+    addHandler(m, 0xFF42, ppu::getYScroll, writeScrollY);
+    addHandler(m, 0xFF43, readScrollX, writeScrollX);
+    addHandler(m, 0xFF44, ppu::getCurrentLine, noWrite);
+    addHandler(m, 0xFF45, readLYC, writeLYC);
+    addHandler(m, 0xFF46, readDMA, writeDMA);
+
+    if (DSEMU_PPU_FIFO) {
+        addHandler(m, 0xFF47, nullptr, writePPURegister<0xFF47>);
+        addHandler(m, 0xFF48, nullptr, writePPURegister<0xFF48>);
+        addHandler(m, 0xFF49, nullptr, writePPURegister<0xFF49>);
+        addHandler(m, 0xFF4A, nullptr, writePPURegister<0xFF4A>);
+        addHandler(m, 0xFF4B, nullptr, writePPURegister<0xFF4B>);
     }
-
-    if (DEBUG) cout << "UNKNOWN IO READ: " << Short(address) << endl;
-    //sleep(5);
-    return 0;
 }
 
-void write(ushort address, byte b) {
+byte read(Machine &m, ushort address) {
+    byte reg = address & 0x7F;
 
-    HANDLER_MAP::iterator it = handlerMap.find(address);
-    
-    if (it != handlerMap.end()) {
-        it->second.second(b);
-        memory::write(address, b);
-        return;
+    if (m.io.readHandlers[reg]) {
+        return m.io.readHandlers[reg](m);
     }
 
-    if (DEBUG) cout << " NO WRITE MAP: " << Short(address) << endl;
-    //sleep(1);
+    return m.ram[address] | readMasks[reg];
+}
 
-    if (address == 0xFF00) {
-        //cout << endl << "JOYPAD WRITE: " << Byte(b) << endl;
-        //memory::write(address, b & (0x10 | 0x20));
-        selButtons = b & 0x20;
-        selDirs = b & 0x10;
-        memory::write(address, b);
-       // sleep(2);
-        return;
-    } else if (address == 0xFF01) {
-       // cout << endl << "SERIAL WRITE: " << endl;
-        //sleep(2);
-        memory::write(address, b);
-        return;
-    } else if (address == 0xFF02) {
-        //cout << endl << "SERIAL WRITE: " << endl;
-        //sleep(2);
-        memory::write(address, b);
-        return;
-    } else if (address == 0xFF03) {
-       // cout << endl << "DIV WRITE: " << endl;
-       // sleep(2);
-        memory::write(address, b);
-        return;
-    } else if (address == 0xFF04) {
-       // cout << endl << "TIMA WRITE: " << endl;
-        //sleep(2);
-        memory::write(address, b);
-        return;
-    } else if (address == 0xFF0F) {
-        cpu::setInterruptsRequestsFlag(b);
-        memory::write(address, b);
-        return;
-    } else if (address == 0xFFFF) {
-        cpu::setInterruptsEnableFlag(b);
-        memory::write(address, b);
-        return;
-    }
+void write(Machine &m, ushort address, byte b) {
+    byte reg = address & 0x7F;
 
-    if (address > 0xFF00) {
-        memory::write(address, b);
+    if (m.io.writeHandlers[reg]) {
+        m.io.writeHandlers[reg](m, b);
+        return;
     }
 
-    if (DEBUG) cout << "UNKNOWN IO WRITE: " << Short(address) << endl;
-    //sleep(5);
+    m.ram[address] = b;
 }
 
 }
-
-
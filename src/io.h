@@ -1,19 +1,18 @@
 #pragma once
 
 #include "common.h"
+#include "machine.h"
 
 namespace dsemu::io {
 
-void init();
-byte read(ushort address);
-void write(ushort address, byte b);
+void init(Machine &m);
+byte read(Machine &m, ushort address);
+void write(Machine &m, ushort address, byte b);
 
-extern bool aDown ;
-extern bool startDown;
-extern bool selectDown;
+//P1 lines 0-3 as the CPU reads them right now, a 0 bit is a pressed button.
+byte joypadLines(Machine &m);
+
+//request the joypad interrupt if a line went low since before.
+void joypadChanged(Machine &m, byte before);
 
-extern bool rightDown;
-extern bool leftDown;
-extern bool upDown;
-extern bool downDown;
 }
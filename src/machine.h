@@ -0,0 +1,412 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+
+/*
+  One Game Boy.
+
+  Everything an emulated machine is made of lives in a Machine, and every
+  subsystem is handed the one it works on, so any number of them can run in
+  one process, each on its own thread.  What stays process wide is
+  configuration (DEBUG, idle skip, the compositor backend) and things that are
+  shared on purpose, like the read only ROM images.
+
+  The layout follows how often things are touched: the CPU registers, cycle
+  counter and next event deadline, which every instruction uses, come first,
+  then the bus page table, then the rest of the peripherals, and the big
+  memory blocks last.
+
+  A Machine is big (the three frame buffers alone are 270KB), allocate it with
+  new or statically and call init() before use.
+*/
+
+namespace dsemu {
+
+struct Machine;
+
+namespace cpu {
+
+struct Register {
+    byte lo;
+    byte hi;
+};
+
+struct Stats {
+    uint64_t instructions;
+    uint64_t haltedCycles;
+    uint64_t idleLoops;
+    uint64_t idleCycles;
+};
+
+//the last loop iteration, see checkIdleLoop() in cpu.cpp.
+struct IdleLoop {
+    bool armed;
+    ushort pc;
+    uint64_t start;
+    uint64_t instructions;
+    ushort af, bc, de, hl, sp;
+    bool ime;
+};
+
+struct State {
+    Register regAF;
+    Register regBC;
+    Register regDE;
+    Register regHL;
+    Register regSP;
+    ushort regPC;
+
+    uint64_t totalTicks;
+
+    bool interruptsEnabled;
+    bool eiCalled;
+    bool haltWaitingForInterrupt;
+    bool stopped;           //halted by STOP, only a joypad line going low ends it
+
+    //set on anything that makes a loop iteration unrepeatable: memory writes
+    //and reads of registers that change without a scheduled event (DIV, TIMA,
+    //joypad).
+    bool volatileAccess;
+
+    byte intEnableFlag;
+    byte intRequestFlag;
+    int extraCycles;
+
+    Stats stats;
+    IdleLoop idle;
+
+    //DEBUG output only, the stack copy is not kept up otherwise.
+    int callSize;
+    bool cameFromI;
+    vector<byte> stack;
+};
+
+}
+
+namespace scheduler {
+
+enum Event {
+    EventPPU,
+    EventTimer,
+    EventInput,
+    EventHost,      //a stop point asked for by whoever drives the core
+    EventCount
+};
+
+typedef void (*EVENT_HANDLER)(Machine &m, uint64_t when);
+
+const uint64_t NEVER = UINT64_MAX;
+
+struct State {
+    uint64_t nextEvent;
+    uint64_t deadlines[EventCount];
+    EVENT_HANDLER handlers[EventCount];
+};
+
+}
+
+namespace bus {
+
+typedef byte (*READ_HANDLER)(Machine &m, ushort address);
+typedef void (*WRITE_HANDLER)(Machine &m, ushort address, byte b);
+
+struct State {
+    byte *readPages[256];
+    byte *writePages[256];
+    READ_HANDLER readHandlers[256];
+    WRITE_HANDLER writeHandlers[256];
+};
+
+}
+
+namespace io {
+
+typedef byte (*IO_READ_HANDLER)(Machine &m);
+typedef void (*IO_WRITE_HANDLER)(Machine &m, byte b);
+typedef void (*SERIAL_HANDLER)(Machine &m, byte b);
+
+struct State {
+    //indexed by address - 0xFF00, null means plain memory.
+    IO_READ_HANDLER readHandlers[0x80];
+    IO_WRITE_HANDLER writeHandlers[0x80];
+
+    byte selButtons;
+    byte selDirs;
+
+    //gets every byte the game sends out the link port, test ROMs print there.
+    SERIAL_HANDLER onSerial;
+};
+
+}
+
+namespace timer {
+
+struct State {
+    uint64_t divBase;
+    uint64_t timaSync;
+    byte tima;
+    byte tma;
+    byte tac;
+};
+
+}
+
+namespace ppu {
+
+const int YRES = 144;
+const int XRES = 160;
+const int TILE_COUNT = 384;
+const int MAX_LINE_SPRITES = 10;
+
+struct ScrollInfo {
+    byte x;
+    byte y;
+};
+
+enum Mode {
+    ModeHBlank = 0,
+    ModeVBlank = 1,
+    ModeOAM = 2,
+    ModeTransfer = 3
+};
+
+struct OAMEntry {
+    byte y;
+    byte x;
+    byte tile;
+    byte flags;
+};
+
+//pixel FIFO renderer state for the line in mode 3, see ppu_fifo.cpp.
+struct Fifo {
+    int line;
+    int dot;            //dots since mode 3 started
+    int x;              //next LCD pixel
+    int discard;        //pixels still to drop before x moves
+    bool done;
+
+    int fetchDot;       //0-6, the row is ready at 6
+    int fetchX;         //tile column of the next fetch
+    bool firstFetch;
+    bool window;
+    byte tile;
+    byte lo;
+    byte hi;
+
+    byte bg[8];
+    int bgHead;
+    int bgCount;
+
+    //lined up with the LCD, obj[0] goes with pixel x.  Colour 0 is no sprite.
+    byte obj[8];
+    byte objAttr[8];
+
+    int nextSprite;     //index into lineSprites
+    int spriteDots;     //dots left on the sprite fetch
+};
+
+//what setTarget() draws: ARGB8888, or one byte per pixel holding the shade 0-3.
+enum Format {
+    FormatARGB,
+    FormatIndex
+};
+
+typedef void (*FRAME_HANDLER)(Machine &m);
+
+struct State {
+    byte lcdControl;
+    byte lcdStats;
+    ScrollInfo scrollInfo;
+    byte currentLine;
+    Mode mode;
+    int currentFrame;
+    int windowLine;
+
+    int renderInterval = 1;
+    bool renderFrame;
+
+    //sprites on the current line in drawing priority order.
+    OAMEntry *lineSprites[MAX_LINE_SPRITES];
+    int lineSpriteCount;
+
+    uint32_t *videoBuffer;
+    int backFrame;
+    int frontFrame;
+    std::atomic<int> spareFrame;
+
+    //caller memory set by setTarget(), indexBuffer is it when it holds shades.
+    void *target;
+    byte *indexBuffer;
+
+    Fifo fifo;
+    bool fifoActive;
+    uint64_t transferStart;
+    int transferLength;
+
+    bool tileDirty[TILE_COUNT];
+
+    //called at every VBlank once the frame is out, a frontend paces here.
+    FRAME_HANDLER onFrame;
+};
+
+}
+
+namespace input {
+
+const uint32_t QUEUE_SIZE = 256;
+
+struct Event {
+    uint64_t cycle;
+    byte button;
+    bool pressed;
+};
+
+struct State {
+    //free running counters, head is only written by the consumer and tail by the producer.
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    Event queue[QUEUE_SIZE];
+
+    byte held;
+};
+
+}
+
+namespace cart {
+
+struct Header {
+    byte entry[4];
+    byte logo[0x30];
+
+    char title[15];
+    byte gbcFlag;
+    byte licCode[2];
+    byte sgbFlag;
+    byte cartType;
+    byte romSize;
+    byte ramSize;
+    byte japFlag;
+    byte oldLicCode;
+    byte maskRomVersion;
+    byte headerChecksum;
+    byte globalChecksum[2];
+};
+
+//MBC3 clock, stored in the save file right after the cart RAM.
+struct RTCSave {
+    uint64_t seconds;
+    byte halted;
+    byte carry;
+    byte reserved[6];
+};
+
+struct State {
+    Header header;
+    byte *romData;
+    int romSize;
+    byte *ramData;
+    int ramSize;
+    RTCSave *rtcSave;
+
+    //set when ramData is a mapping of the save file rather than heap memory.
+    size_t savMapSize;
+
+    //a ROM loaded from memory is a private copy, ROM files are shared images.
+    byte *bufferROM;
+};
+
+}
+
+namespace mappers {
+
+typedef void (*CONTROL_HANDLER)(Machine &m, ushort address, byte b);
+typedef byte (*RAM_READ_HANDLER)(Machine &m, ushort address);
+typedef void (*RAM_WRITE_HANDLER)(Machine &m, ushort address, byte b);
+
+struct Mapper {
+    byte *romBanks[2];      //0000-3FFF and 4000-7FFF
+    byte *ramBank;          //A000-BFFF, null while RAM is disabled
+    CONTROL_HANDLER control;
+    RAM_READ_HANDLER readRAM;
+    RAM_WRITE_HANDLER writeRAM;
+    bool battery;
+    bool rtc;
+};
+
+struct MBC1 {
+    bool ramEnabled;
+    byte bankLo;
+    byte bankHi;
+    byte mode;
+};
+
+struct MBC3 {
+    bool ramEnabled;
+    byte romBank;
+    byte ramSelect;
+    byte latchWrite;
+    byte latched[5];
+};
+
+struct MBC5 {
+    bool ramEnabled;
+    ushort romBank;
+    byte ramBank;
+    byte ramMask;
+};
+
+struct State {
+    Mapper mapper;
+    void (*update)(Machine &m);
+
+    MBC1 mbc1;
+    MBC3 mbc3;
+    MBC5 mbc5;
+
+    //lowest and highest RAM bank enabled since the last flush.
+    int dirtyLo;
+    int dirtyHi;
+
+    uint64_t rtcBase;
+    cart::RTCSave rtcNoSave;
+};
+
+}
+
+namespace trace {
+
+struct Record;
+
+struct Ring {
+    bool enabled;
+    Record *records;
+    uint64_t head;
+    uint64_t mask;
+};
+
+}
+
+struct Machine {
+    cpu::State cpu;
+    scheduler::State scheduler;
+    bus::State bus;
+    io::State io;
+    timer::State timer;
+    ppu::State ppu;
+    input::State input;
+    mappers::State mappers;
+    cart::State cart;
+    trace::Ring trace;
+
+    byte ram[0xFFFF + 1];
+    byte oamRAM[160];
+
+    //the 384 tiles at 8000-97FF as one colour index (0-3) per pixel.
+    byte tileCache[ppu::TILE_COUNT][8][8];
+
+    uint32_t frameBuffers[3][ppu::XRES * ppu::YRES];
+};
+
+}
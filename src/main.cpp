@@ -4,6 +4,10 @@
 #include "emu.h"
 #include "ui.h"
 #include "ppu.h"
+#include "trace.h"
+#include "compositor.h"
+#include "scaler.h"
+#include "pacer.h"
 
 #include <cstring>
 #include <unistd.h>
@@ -17,27 +21,79 @@ using namespace dsemu;
 int main(int argc, char **argv) {
     cout << "Starting main.." << endl;
 
-    std::memset(ram, 0, 0xFFFF);
+    string romFile;
+    string traceFile;
+    uint64_t traceSize = 1 << 20;
+
+    Machine *m = new Machine();
+    m->ppu.onFrame = pacer::frame;
+
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+
+        if (arg == "--trace" && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else if (arg == "--trace-size" && i + 1 < argc) {
+            traceSize = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--render-every" && i + 1 < argc) {
+            ppu::setRenderInterval(*m, atoi(argv[++i]));
+        } else if (arg == "--no-render") {
+            ppu::setRenderInterval(*m, 0);
+        } else if (arg == "--speed" && i + 1 < argc) {
+            if (!pacer::parse(argv[++i])) {
+                cout << "Unknown speed: " << argv[i] << endl;
+                return -1;
+            }
+        } else if (arg == "--turbo" && i + 1 < argc) {
+            ui::turbo = atof(argv[++i]);
+        } else if (arg == "--viewer") {
+            ui::showViewer = true;
+        } else if (arg == "--grab-scale" && i + 1 < argc) {
+            if (!scaler::parse(argv[++i], ui::grabFilter, ui::grabFactor)) {
+                cout << "Unknown scaler: " << argv[i] << endl;
+                return -1;
+            }
+        } else if (arg == "--prefetch") {
+            cart::prefetchROM = true;
+        } else if (arg == "--compositor" && i + 1 < argc) {
+            string name = argv[++i];
+            int b = 0;
+
+            while (b < compositor::BackendCount && name != compositor::name((compositor::Backend)b)) {
+                b++;
+            }
+
+            if (!compositor::select((compositor::Backend)b)) {
+                cout << "Compositor not available: " << name << endl;
+                return -1;
+            }
+        } else {
+            romFile = arg;
+        }
+    }
 
-    dsemu::cart::load((const char *)argv[1]);
+    if (!traceFile.empty()) {
+        trace::enable(m->trace, traceSize);
+        trace::dumpOnExit(m->trace, traceFile);
+    }
 
-    std::memcpy(ram, dsemu::cart::g_romData, 0x8000);
+    if (!dsemu::cart::load(*m, romFile)) {
+        return -1;
+    }
 
-    ui::init();
+    cout << "Compositor: " << compositor::name(compositor::current()) << endl;
 
-    std::thread t(dsemu::run);
+    ui::init();
 
-    int prevFrame = 0;
+    std::thread t(dsemu::run, std::ref(*m));
 
     while(true) {
-        sleepMs(1);
-        ui::handleEvents();
+        pacer::waitFrame(5);
+        ui::handleEvents(*m);
 
-        if (prevFrame != ppu::currentFrame) {
-            ui::update();
+        if (const uint32_t *frame = ppu::takeFrame(*m)) {
+            ui::update(*m, frame);
         }
-
-        prevFrame = ppu::currentFrame;
     }
 
 /*
@@ -1,124 +1,379 @@
 #include "mappers.h"
 #include "cart.h"
-#include "memory.h"
-#include <cstring>
-
-using std::memcpy;
+#include "bus.h"
+#include "cpu.h"
 
 namespace dsemu::mappers {
 
-bool init = false;
-byte data[0xFFFF];
-bool switched = false;
+static byte *romBank(Machine &m, int bank) {
+    int count = m.cart.romSize / 0x4000;
+
+    return m.cart.romData + ((bank % count) * 0x4000);
+}
+
+static byte *ramBank(Machine &m, int bank) {
+    int count = m.cart.ramSize / 0x2000;
+
+    if (count == 0) {
+        return nullptr;
+    }
+
+    bank %= count;
 
-byte NROMMapper::read(ushort address) {
+    if (m.mappers.dirtyLo < 0 || bank < m.mappers.dirtyLo) m.mappers.dirtyLo = bank;
+    if (bank > m.mappers.dirtyHi) m.mappers.dirtyHi = bank;
 
-    return cart::g_romData[address];
+    return m.cart.ramData + (bank * 0x2000);
 }
 
-void NROMMapper::control(ushort address, byte b) {
-    //nothing to do for this one...
-    cout << "CONTROL" << endl;
+void mapPages(Machine &m) {
+    Mapper &mapper = m.mappers.mapper;
+
+    bus::mapRead(m, 0x00, 0x40, mapper.romBanks[0]);
+    bus::mapRead(m, 0x40, 0x40, mapper.romBanks[1]);
+    bus::mapRead(m, 0xA0, 0x20, mapper.ramBank);
+    bus::mapWrite(m, 0xA0, 0x20, mapper.ramBank);
+}
+
+static byte readNoRAM(Machine &m, ushort address) {
+    return 0xFF;
+}
+
+static void writeNoRAM(Machine &m, ushort address, byte b) {
+}
+
+static void updateNROM(Machine &m) {
+    Mapper &mapper = m.mappers.mapper;
+
+    mapper.romBanks[0] = romBank(m, 0);
+    mapper.romBanks[1] = romBank(m, 1);
+    mapper.ramBank = ramBank(m, 0);
+
+    mapPages(m);
+}
+
+static void controlNROM(Machine &m, ushort address, byte b) {
 }
 
-byte MPC1::read(ushort address) {
-    if (!init) {
-        cout << "INIT" << endl;
-        memcpy(data, cart::g_romData, 0x8000);
-        init = true;
-    }
 /*
-    if (init) {
-        //cout << "READ: " << Short(address) << endl;
-
-        if (switched && address >= 0x4000 && bank > 1) {
-            cout << "READ: " << Short(address) << " to " << std::hex << (int)(address + (bank * 0x4000))<< endl;
-            sleepMs(500);
-        } else if (bank > 1) {
-            cout << "BANK0READ: " << Short(address) << endl;
+  MBC1
+    0000-1FFF: RAM enable, 0x0A in the low nibble enables.
+    2000-3FFF: low 5 bits of the ROM bank, 0 selects 1.
+    4000-5FFF: 2 bits, either the RAM bank or bits 5-6 of the ROM bank.
+    6000-7FFF: banking mode, in mode 1 the 2 bit register also banks
+               0000-3FFF and the RAM.
+*/
+static void updateMBC1(Machine &m) {
+    Mapper &mapper = m.mappers.mapper;
+    MBC1 &mbc1 = m.mappers.mbc1;
+
+    mapper.romBanks[0] = romBank(m, mbc1.mode ? (mbc1.bankHi << 5) : 0);
+    mapper.romBanks[1] = romBank(m, (mbc1.bankHi << 5) | mbc1.bankLo);
+    mapper.ramBank = mbc1.ramEnabled ? ramBank(m, mbc1.mode ? mbc1.bankHi : 0) : nullptr;
+
+    mapPages(m);
+}
+
+static void controlMBC1(Machine &m, ushort address, byte b) {
+    MBC1 &mbc1 = m.mappers.mbc1;
+
+    if (address < 0x2000) {
+        bool wasEnabled = mbc1.ramEnabled;
+        mbc1.ramEnabled = (b & 0x0F) == 0x0A;
+
+        if (wasEnabled && !mbc1.ramEnabled) {
+            flush(m);
         }
+    } else if (address < 0x4000) {
+        mbc1.bankLo = b & 0x1F;
 
-        //return memory::ram[address];
-        //return data[address];
+        if (mbc1.bankLo == 0) {
+            mbc1.bankLo = 1;
+        }
+    } else if (address < 0x6000) {
+        mbc1.bankHi = b & 0x03;
+    } else {
+        mbc1.mode = b & 0x01;
     }
+
+    updateMBC1(m);
+}
+
+/*
+  MBC3 real time clock.
+
+  The clock counts emulated time rather than wall-clock time so runs stay
+  deterministic, and only its counter (not a timestamp) is saved.  It is
+  brought up to date lazily whenever it is latched or written.
 */
-    if (address < 0x4000) {
-        return cart::g_romData[address];
+const uint64_t TICKS_PER_SECOND = 1 << 20;
+const uint64_t RTC_WRAP = 512ULL * 24 * 60 * 60;
+
+enum RTCRegister {
+    RTCSeconds,
+    RTCMinutes,
+    RTCHours,
+    RTCDaysLo,
+    RTCDaysHi
+};
+
+static cart::RTCSave &rtcState(Machine &m) {
+    return m.cart.rtcSave ? *m.cart.rtcSave : m.mappers.rtcNoSave;
+}
+
+static void syncRTC(Machine &m) {
+    cart::RTCSave &rtc = rtcState(m);
+    uint64_t now = cpu::getTickCount(m);
+
+    if (rtc.halted) {
+        m.mappers.rtcBase = now;
+        return;
+    }
+
+    uint64_t elapsed = (now - m.mappers.rtcBase) / TICKS_PER_SECOND;
+    m.mappers.rtcBase += elapsed * TICKS_PER_SECOND;
+    rtc.seconds += elapsed;
+
+    if (rtc.seconds >= RTC_WRAP) {
+        rtc.seconds %= RTC_WRAP;
+        rtc.carry = 1;
     }
+}
 
-    if (bank > 1) {
-        //cout << "BANK READ: " << (int)bank << " - " << Short(address) << " to " << std::hex << (int)(address + (bank * 0x4000)) << endl;
-        //sleepMs(200);
+static byte readRTC(RTCRegister reg, const cart::RTCSave &rtc) {
+    uint64_t days = rtc.seconds / 86400;
+
+    switch(reg) {
+        case RTCSeconds: return rtc.seconds % 60;
+        case RTCMinutes: return (rtc.seconds / 60) % 60;
+        case RTCHours: return (rtc.seconds / 3600) % 24;
+        case RTCDaysLo: return days & 0xFF;
+        case RTCDaysHi: return ((days >> 8) & 1) | (rtc.halted ? 0x40 : 0) | (rtc.carry ? 0x80 : 0);
     }
 
-    return cart::g_romData[address + (bank * 0x4000) - 0x4000];
+    return 0xFF;
 }
 
-void MPC1::control(ushort address, byte b) {
-    cout << "CONTROL" << endl;
+static void writeRTC(Machine &m, RTCRegister reg, byte b) {
+    syncRTC(m);
+
+    cart::RTCSave &rtc = rtcState(m);
+    uint64_t s = rtc.seconds % 60;
+    uint64_t min = (rtc.seconds / 60) % 60;
+    uint64_t h = (rtc.seconds / 3600) % 24;
+    uint64_t d = rtc.seconds / 86400;
 
-    if (!init) {
-        memcpy(data, cart::g_romData, 0x8000);
-        init = true;
+    switch(reg) {
+        case RTCSeconds: {
+            s = b % 60;
+            m.mappers.rtcBase = cpu::getTickCount(m);
+        } break;
+        case RTCMinutes: min = b % 60; break;
+        case RTCHours: h = b % 24; break;
+        case RTCDaysLo: d = (d & 0x100) | b; break;
+        case RTCDaysHi: {
+            d = (d & 0xFF) | ((b & 1) << 8);
+            rtc.halted = (b & 0x40) != 0;
+            rtc.carry = (b & 0x80) != 0;
+        } break;
     }
+
+    rtc.seconds = ((d * 24 + h) * 60 + min) * 60 + s;
+}
+
 /*
-    if (init) {
-        if (address >= 0x2000 && address <= 0x3FFF) {
-            bank = b & 0x1F;
-            if(bank == 0 || bank == 0x20 || bank == 0x40 || bank == 0x60)
-                bank++;
+  MBC3
+    0000-1FFF: RAM and clock enable.
+    2000-3FFF: 7 bit ROM bank, 0 selects 1.
+    4000-5FFF: RAM bank 0-3, or 08-0C to put a clock register at A000-BFFF.
+    6000-7FFF: writing 00 then 01 latches the clock into its registers.
+*/
+static byte readMBC3Clock(Machine &m, ushort address) {
+    MBC3 &mbc3 = m.mappers.mbc3;
 
-            switched = true;
+    if (mbc3.ramEnabled && m.mappers.mapper.rtc && mbc3.ramSelect >= 0x08 && mbc3.ramSelect <= 0x0C) {
+        return mbc3.latched[mbc3.ramSelect - 0x08];
+    }
+
+    return 0xFF;
+}
+
+static void writeMBC3Clock(Machine &m, ushort address, byte b) {
+    MBC3 &mbc3 = m.mappers.mbc3;
+
+    if (mbc3.ramEnabled && m.mappers.mapper.rtc && mbc3.ramSelect >= 0x08 && mbc3.ramSelect <= 0x0C) {
+        writeRTC(m, (RTCRegister)(mbc3.ramSelect - 0x08), b);
+    }
+}
+
+static void updateMBC3(Machine &m) {
+    Mapper &mapper = m.mappers.mapper;
+    MBC3 &mbc3 = m.mappers.mbc3;
+
+    mapper.romBanks[1] = romBank(m, mbc3.romBank);
+    mapper.ramBank = mbc3.ramEnabled && mbc3.ramSelect < 0x08 ? ramBank(m, mbc3.ramSelect) : nullptr;
+
+    mapPages(m);
+}
+
+static void controlMBC3(Machine &m, ushort address, byte b) {
+    MBC3 &mbc3 = m.mappers.mbc3;
 
-            cout << "SWITCHING BANK: " << (int) bank << endl;
-            sleepMs(200);
+    if (address < 0x2000) {
+        bool wasEnabled = mbc3.ramEnabled;
+        mbc3.ramEnabled = (b & 0x0F) == 0x0A;
 
-            memcpy(&data[0x4000], cart::g_romData + (bank * 0x4000), 0x4000);
+        if (wasEnabled && !mbc3.ramEnabled) {
+            flush(m);
         }
-        return;
+    } else if (address < 0x4000) {
+        mbc3.romBank = b & 0x7F;
+
+        if (mbc3.romBank == 0) {
+            mbc3.romBank = 1;
+        }
+    } else if (address < 0x6000) {
+        mbc3.ramSelect = b & 0x0F;
+    } else {
+        if (mbc3.latchWrite == 0x00 && b == 0x01 && m.mappers.mapper.rtc) {
+            syncRTC(m);
+
+            for (int i=0; i<5; i++) {
+                mbc3.latched[i] = readRTC((RTCRegister)i, rtcState(m));
+            }
+        }
+
+        mbc3.latchWrite = b;
     }
+
+    updateMBC3(m);
+}
+
+/*
+  MBC5
+    0000-1FFF: RAM enable.
+    2000-2FFF: low 8 bits of the ROM bank, bank 0 can be selected.
+    3000-3FFF: bit 8 of the ROM bank.
+    4000-5FFF: RAM bank 0-F, bit 3 drives the motor on rumble carts.
 */
-    if (address >= 0x6000) {
-        //TODO: Memory model select...
-    } else if (address >= 0x2000 && address <= 0x3FFF) {
-        bank = b & 0x1F;
+static void updateMBC5(Machine &m) {
+    Mapper &mapper = m.mappers.mapper;
+    MBC5 &mbc5 = m.mappers.mbc5;
+
+    mapper.romBanks[1] = romBank(m, mbc5.romBank);
+    mapper.ramBank = mbc5.ramEnabled ? ramBank(m, mbc5.ramBank & mbc5.ramMask) : nullptr;
+
+    mapPages(m);
+}
+
+static void controlMBC5(Machine &m, ushort address, byte b) {
+    MBC5 &mbc5 = m.mappers.mbc5;
+
+    if (address < 0x2000) {
+        bool wasEnabled = mbc5.ramEnabled;
+        mbc5.ramEnabled = (b & 0x0F) == 0x0A;
 
-        if (bank == 0 || bank == 0x20 || bank == 0x40 || bank == 0x60) {
-            bank++;
+        if (wasEnabled && !mbc5.ramEnabled) {
+            flush(m);
         }
+    } else if (address < 0x3000) {
+        mbc5.romBank = (mbc5.romBank & 0x100) | b;
+    } else if (address < 0x4000) {
+        mbc5.romBank = (mbc5.romBank & 0xFF) | ((b & 1) << 8);
+    } else if (address < 0x6000) {
+        mbc5.ramBank = b & 0x0F;
+    }
+
+    updateMBC5(m);
+}
+
+void flush(Machine &m) {
+    Mapper &mapper = m.mappers.mapper;
+
+    if (mapper.rtc) {
+        syncRTC(m);
+    }
+
+    if (m.mappers.dirtyLo >= 0) {
+        cart::flushRAM(m, m.mappers.dirtyLo * 0x2000, (m.mappers.dirtyHi - m.mappers.dirtyLo + 1) * 0x2000);
+    }
+
+    if (m.cart.rtcSave) {
+        cart::flushRAM(m, m.cart.ramSize, sizeof(cart::RTCSave));
+    }
+
+    //still mapped banks stay dirty.
+    m.mappers.dirtyLo = m.mappers.dirtyHi = -1;
+
+    if (mapper.ramBank) {
+        ramBank(m, (mapper.ramBank - m.cart.ramData) / 0x2000);
+    }
+}
+
+bool init(Machine &m, byte cartType) {
+    Mapper &mapper = m.mappers.mapper;
 
-        if (bank * 0x4000 > cart::g_romSize - 0x4000) {
-            cout << "FAILURE IN MAPPER CONTROL" << endl;
-            exit(-1);
+    mapper.readRAM = readNoRAM;
+    mapper.writeRAM = writeNoRAM;
+    mapper.battery = false;
+    mapper.rtc = false;
+
+    switch(cartType) {
+        case 0x00:
+        case 0x08:
+        case 0x09: {
+            mapper.control = controlNROM;
+            mapper.battery = cartType == 0x09;
+            m.mappers.update = updateNROM;
+        } break;
+        case 0x01:
+        case 0x02:
+        case 0x03: {
+            mapper.control = controlMBC1;
+            mapper.battery = cartType == 0x03;
+            m.mappers.update = updateMBC1;
+        } break;
+        case 0x0F:
+        case 0x10:
+        case 0x11:
+        case 0x12:
+        case 0x13: {
+            mapper.control = controlMBC3;
+            mapper.readRAM = readMBC3Clock;
+            mapper.writeRAM = writeMBC3Clock;
+            mapper.battery = cartType == 0x0F || cartType == 0x10 || cartType == 0x13;
+            mapper.rtc = cartType == 0x0F || cartType == 0x10;
+            m.mappers.update = updateMBC3;
+        } break;
+        case 0x19:
+        case 0x1A:
+        case 0x1B:
+        case 0x1C:
+        case 0x1D:
+        case 0x1E: {
+            mapper.control = controlMBC5;
+            mapper.battery = cartType == 0x1B || cartType == 0x1E;
+            m.mappers.update = updateMBC5;
+        } break;
+        default: {
+            return false;
         }
     }
+
+    return true;
 }
 
+void reset(Machine &m) {
+    m.mappers.mbc1 = {false, 1, 0, 0};
+    m.mappers.mbc3 = {false, 1, 0, 0xFF, {}};
+    m.mappers.mbc5 = {false, 1, 0, (byte)(m.cart.header.cartType >= 0x1C ? 0x07 : 0x0F)};
+
+    m.mappers.dirtyLo = m.mappers.dirtyHi = -1;
+    m.mappers.rtcBase = cpu::getTickCount(m);
+    m.mappers.rtcNoSave = {};
+
+    m.mappers.mapper.romBanks[0] = romBank(m, 0);
+    m.mappers.update(m);
 }
 
-/*
--            if (cart::g_header.cartType == 1 && address >= 0x6000) {
--                cout << "Memory Model Select: " << Byte(b & 1) << endl;
--                sleep(10);
--            } else if (cart::g_header.cartType == 1 && address >= 0x2000 && address <= 0x3FFF) {
--                //cout << "Rom Bank Select: " << Byte(b & 0x1F) << endl;
--
--                byte bank = b & 0x1F;
--                if(bank == 0 || bank == 0x20 || bank == 0x40 || bank == 0x60)
--                    bank++;
--
--                memcpy(&memory::ram[0x4000], cart::g_romData + (bank * 0x4000), 0x4000);
--
--                //cout << "Copied starting at: " << (int)(bank * 0x4000) << " - size: " << cart::g_romSize << endl;
--
--                if ((bank * 0x4000) > cart::g_romSize) {
--                    cout << "TOO BIG" << endl;
--                    sleep(10);
--                }
--
--                //sleep(1);
--            } else if (cart::g_header.cartType == 1 ) {
--                cout << "OTHER: " << Short(address) << endl;
--                sleep(10);
--            }
-*/
\ No newline at end of file
+}
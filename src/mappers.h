@@ -1,31 +1,30 @@
 #pragma once
 
 #include "common.h"
+#include "machine.h"
 
-namespace dsemu::mappers {
+/*
+  Memory bank controllers.
 
-class Mapper {
-public:
-    virtual byte read(ushort address) = 0;
-    virtual void control(ushort address, byte b) = 0;
+  The current banks are kept as host pointers that only change when the game
+  writes to a control register, so ROM and cart RAM reads never go through the
+  mapper at all, the bus pages point straight at the banks.  Only cart RAM
+  accesses that are not plain memory (disabled RAM, MBC3 clock registers) go
+  through readRAM/writeRAM.
+*/
 
-private:
-};
+namespace dsemu::mappers {
 
-class NROMMapper : public Mapper {
-public:
-    virtual byte read(ushort address);
-    virtual void control(ushort address, byte b);
+//picks the controller for the header cart type, false if it is not supported.
+bool init(Machine &m, byte cartType);
 
-};
+//puts the controller in its power on state, once the cart RAM is set up.
+void reset(Machine &m);
 
-class MPC1 : public Mapper {
-public:
-    virtual byte read(ushort address);
-    virtual void control(ushort address, byte b);
+//points the bus ROM and cart RAM pages at the current banks.
+void mapPages(Machine &m);
 
-private:
-    int bank = 0;
-};
+//writes back cart RAM banks enabled since the last flush, and the clock.
+void flush(Machine &m);
 
 }
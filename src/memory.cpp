@@ -1,13 +1,11 @@
 #include "memory.h"
-#include "cpu.h"
-#include "ppu.h"
 #include <cstring>
 
 namespace dsemu::memory {
 
-    byte ram[0xFFFF + 1];
+    void init(Machine &m) {
+        byte *ram = m.ram;
 
-    void init() {
         ram[0xFF05] = 0x00;
         ram[0xFF06] = 0x00;
         ram[0xFF07] = 0x00;
@@ -40,29 +38,15 @@ namespace dsemu::memory {
         ram[0xFF4B] = 0x00;
         ram[0xFFFF] = 0x00;
 
-        std::memset(ram, 0, sizeof(ram));
+        std::memset(m.ram, 0, sizeof(m.ram));
     }
 
-    byte read(ushort address) {
-
-        if (address == 0xFF44) {
-            return ppu::getCurrentLine();
-        }
-
-        return ram[address];
+    byte read(Machine &m, ushort address) {
+        return m.ram[address];
     }
 
-    void write(ushort address, byte value) {
-        ram[address] = value;
-
-        if (address == 0xFFFF) {
-            cout << "\t - IE EN REGISTER WRITE: " << Byte(value) << endl;
-            cpu::handleInterrupt(value, false);
-        } else if (address == 0xFF0F) {
-            cout << "\t - IE FL REGISTER WRITE: " << Byte(value) << endl;
-            
-            //cpu::handleInterrupt(value, true);
-        }
+    void write(Machine &m, ushort address, byte value) {
+        m.ram[address] = value;
     }
 
 }
@@ -1,13 +1,12 @@
 #pragma once
 
 #include "common.h"
+#include "machine.h"
 
 namespace dsemu::memory {
 
-
-    extern byte ram[0xFFFF + 1];
-
-    byte read(ushort address);
-    void write(ushort address, byte value);
+    void init(Machine &m);
+    byte read(Machine &m, ushort address);
+    void write(Machine &m, ushort address, byte value);
 
 }
@@ -1,8 +1,9 @@
 #include "cpu.h"
+#include "opcodes.h"
 #include "memory.h"
 #include "bus.h"
 
-#include <map>
+#include <array>
 #include <utility>
 #include <unistd.h>
 
@@ -15,1073 +16,761 @@ ushort toShort(byte a, byte b) {
 
 namespace dsemu::cpu {
 
-typedef int (*HANDLER)(const OpCode &op);
-
-std::map<Op, HANDLER> handlerMap;
-
-enum RegParamType {
-    RPT16,
-    RPTHi,
-    RPTLo
-};
-
-typedef std::map<ParamType, std::pair<Register *, RegParamType>> PTM;
-
-PTM paramTypeMap;
-bool eiCalled = false;
-
-bool interruptsEnabled;
-
-
-extern int cpuSpeed;
-std::map<byte, byte> jumpCycleMap;
-
-void initParamTypeMap() {
-    paramTypeMap[A] = std::make_pair(&regAF, RPTHi);
-    paramTypeMap[B] = std::make_pair(&regBC, RPTHi);
-    paramTypeMap[C] = std::make_pair(&regBC, RPTLo);
-    paramTypeMap[D] = std::make_pair(&regDE, RPTHi);
-    paramTypeMap[E] = std::make_pair(&regDE, RPTLo);
-    paramTypeMap[H] = std::make_pair(&regHL, RPTHi);
-    paramTypeMap[L] = std::make_pair(&regHL, RPTLo);
-    paramTypeMap[BC] = std::make_pair(&regBC, RPT16);
-    paramTypeMap[SP] = std::make_pair(&regSP, RPT16);
-    paramTypeMap[HL] = std::make_pair(&regHL, RPT16);
-    paramTypeMap[DE] = std::make_pair(&regDE, RPT16);
-    paramTypeMap[AF] = std::make_pair(&regAF, RPT16);
-
-    jumpCycleMap[0x20] = 4;
-    jumpCycleMap[0x30] = 4;
-    jumpCycleMap[0x28] = 4;
-    jumpCycleMap[0x38] = 4;
-    jumpCycleMap[0xC0] = 12;
-    jumpCycleMap[0xD0] = 12;
-    jumpCycleMap[0xC2] = 4;
-    jumpCycleMap[0xD2] = 4;
-    jumpCycleMap[0xC4] = 12;
-    jumpCycleMap[0xD4] = 12;
-    jumpCycleMap[0xC8] = 12;
-    jumpCycleMap[0xD8] = 12;
-    jumpCycleMap[0xCA] = 4;
-    jumpCycleMap[0xDA] = 4;
-    jumpCycleMap[0xCC] = 12;
-    jumpCycleMap[0xDC] = 12;
+typedef int (*HANDLER)(Machine &m, const OpCode &op);
 
-}
+template<auto>
+constexpr bool unhandled = false;
 
-byte *regFromBits(byte reg) {
-    byte *pReg = nullptr;
-
-    switch(reg) {
-        case 0: pReg = &regBC.hi; break; //cout << "GOT B" << endl; break;
-        case 1: pReg = &regBC.lo; break; // cout << "GOT C" << endl; break;
-        case 2: pReg = &regDE.hi; break; // cout << "GOT D" << endl; break;
-        case 3: pReg = &regDE.lo; break; // cout << "GOT E" << endl; break;
-        case 4: pReg = &regHL.hi; break; // cout << "GOT H" << endl; break;
-        case 5: pReg = &regHL.lo; break; // cout << "GOT L" << endl; break;
-        case 6: pReg = &memory::ram[toShort(regHL.lo, regHL.hi)]; break;
-        case 7: pReg = &regAF.hi; break;
-            default:
-                cout << "INVALID REG " << endl;
-                exit(-1);
+/*
+  Extra cycles taken by a conditional jump/call/ret when the condition is met.
+*/
+constexpr int jumpCycles(byte opcode) {
+    switch(opcode) {
+        case 0x20:
+        case 0x30:
+        case 0x28:
+        case 0x38:
+            return 4;
+        case 0xC2:
+        case 0xD2:
+        case 0xCA:
+        case 0xDA:
+            return 4;
+        case 0xC0:
+        case 0xD0:
+        case 0xC4:
+        case 0xD4:
+        case 0xC8:
+        case 0xD8:
+        case 0xCC:
+        case 0xDC:
+            return 12;
+        default:
+            return 0;
     }
+}
 
-    return pReg;
+/*
+  Operand access, resolved at compile time from the ParamType in the opcode table.
+*/
+template<ParamType P>
+inline byte &reg8(Machine &m) {
+    if constexpr (P == A) return m.cpu.regAF.hi;
+    else if constexpr (P == B) return m.cpu.regBC.hi;
+    else if constexpr (P == C) return m.cpu.regBC.lo;
+    else if constexpr (P == D) return m.cpu.regDE.hi;
+    else if constexpr (P == E) return m.cpu.regDE.lo;
+    else if constexpr (P == H) return m.cpu.regHL.hi;
+    else if constexpr (P == L) return m.cpu.regHL.lo;
+    else static_assert(unhandled<P>, "not an 8 bit register");
 }
 
-byte *getPointer(ParamType pt, bool hlAsRam = true) {
-    switch(pt) {
-        case A: return &regAF.hi;
-        case B: return &regBC.hi; 
-        case C: return &regBC.lo; 
-        case D: return &regDE.hi; 
-        case E: return &regDE.lo; 
-        case H: return &regHL.hi; 
-        case L: return &regHL.lo;
-        case AF: return &regAF.lo;
-        case BC: return &regBC.lo;
-        case DE: return &regDE.lo;
-        case SP: return &regSP.lo;
-        case N: {
-            //byte t = memory::ram[(regPC + 1)];
-            //unsigned int i = 
-            return &memory::ram[(regPC + 1)]; 
-        } case HL: {
-            return hlAsRam ? &memory::ram[getReg16Value(regHL)] : &regHL.lo;
-        }
-        default:
-            break;
-    }
+template<ParamType P>
+inline ushort &reg16(Machine &m) {
+    if constexpr (P == AF) return *getReg16Pointer(m.cpu.regAF);
+    else if constexpr (P == BC) return *getReg16Pointer(m.cpu.regBC);
+    else if constexpr (P == DE) return *getReg16Pointer(m.cpu.regDE);
+    else if constexpr (P == HL) return *getReg16Pointer(m.cpu.regHL);
+    else if constexpr (P == SP) return *getReg16Pointer(m.cpu.regSP);
+    else static_assert(unhandled<P>, "not a 16 bit register");
+}
 
-    cout << "ERROR BAD POINTER" << endl;
-    exit(-1);
+inline ushort readImm16(Machine &m) {
+    return toShort(bus::read(m, m.cpu.regPC + 1), bus::read(m, m.cpu.regPC + 2));
+}
 
-    return nullptr;
+//8 bit operand, (HL) means memory at HL.
+template<ParamType P>
+inline byte read8(Machine &m) {
+    if constexpr (P == N) return bus::read(m, m.cpu.regPC + 1);
+    else if constexpr (P == HL) return bus::read(m, getReg16Value(m.cpu.regHL));
+    else return reg8<P>(m);
 }
 
-int handleGoto(ushort address) {
-    return 0;
+template<ParamType P>
+inline void write8(Machine &m, byte b) {
+    if constexpr (P == HL) bus::write(m, getReg16Value(m.cpu.regHL), b);
+    else reg8<P>(m) = b;
 }
 
-int handleLDH(const OpCode &op) {
-    bool srcIsA = op.params[1] == A;
+template<ParamType P>
+inline ushort address(Machine &m) {
+    if constexpr (P == NN) return readImm16(m);
+    else if constexpr (P == N) return 0xFF00 | bus::read(m, m.cpu.regPC + 1);
+    else return reg16<P>(m);
+}
 
-    if (srcIsA) {
-        byte *p = getPointer(op.params[0]);
-        //cout << "READING B: " << Int64((uint64_t)p) << endl;
-        //cout << "B: " << Byte(*p) << endl;
-        
-        bus::write(*p | 0xFF00, regAF.hi);
+template<ParamType DST, ParamType SRC>
+int handleLDH(Machine &m, const OpCode &op) {
+    if constexpr (SRC == A) {
+        bus::write(m, read8<DST>(m) | 0xFF00, m.cpu.regAF.hi);
     } else {
-        byte *p = getPointer(op.params[1]);
-        regAF.hi = bus::read(*p | 0xFF00);
+        m.cpu.regAF.hi = bus::read(m, read8<SRC>(m) | 0xFF00);
     }
     return 0;
 }
 
-ushort getAddrValue(ParamType op, short srcValue) {
-    switch(op) {
-        case HL: return getReg16Value(regHL);
-        case AF: return getReg16Value(regAF);
-        case BC: return getReg16Value(regBC);
-        case DE: return getReg16Value(regDE);
-        case NN: return srcValue;
-        case N: return 0xFF00 | srcValue;
-        default: 
-            cout << "ERROR BAD ADDR VAL: " << endl;
-            exit(-1);
-            return 0;
-    }
-}
-
-int handleLD(const OpCode &op) {
-    RegParamType srcType = RegParamType::RPTHi;
-    RegParamType dstType;
-
-    Register *src;
-    Register *dst;
-
-    ushort srcValue = 0;
-    ushort dstValue = 0;
-
-    PTM::iterator dit = paramTypeMap.find(op.params[0]);
-    PTM::iterator sit = paramTypeMap.find(op.params[1]);
-
-    if (sit == paramTypeMap.end()) {
-        if (op.params[1] == N) {
-            srcValue = bus::read(regPC + 1);
-        } else if (op.params[1] == NN) {
-            srcValue = bus::read(regPC + 1);
-            srcValue |= bus::read(regPC + 2) << 8;
-
-            if (srcValue == 0x1200 || srcValue == 0x0012) {
-                cout << "LDing ... " << Short(srcValue) << endl;
-                //cpuSpeed = 500;
-            }
-
+template<ParamType DST, ParamType SRC, AddrType MODE>
+int handleLD(Machine &m, const OpCode &op) {
+    if constexpr (MODE == ATypeIR) {
+        if constexpr (SRC == NN) {
+            reg16<DST>(m) = readImm16(m);
         } else {
-            cout << "Unknown LD Source Type " << endl;
-            exit(-1);
+            reg8<DST>(m) = bus::read(m, m.cpu.regPC + 1);
         }
-    } else {
-        src = sit->second.first;
-        srcType = sit->second.second;
-
-        switch(srcType) {
-            case RPT16: {
-                ushort *p = (ushort *)src;
-                srcValue = *p;
-            } break;
-            case RPTHi: {
-                srcValue = src->hi;
-            } break;
-            case RPTLo: {
-                srcValue = src->lo;
-            } break;
+    } else if constexpr (MODE == ATypeRR) {
+        reg8<DST>(m) = reg8<SRC>(m);
+    } else if constexpr (MODE == ATypeRA) {
+        if constexpr (SRC == SP) {
+            bus::write(m, address<DST>(m), reg16<SP>(m));
+        } else {
+            byte b = read8<SRC>(m);
+            bus::write(m, address<DST>(m), b);
         }
-    }
-
-    if (dit == paramTypeMap.end()) {
-        dst = nullptr;
-        dstType = RegParamType::RPT16;
-
-        if (op.params[0] == N) {
-            //
-            //exit(-1);
-            dstValue = bus::read(regPC + 1);
-        } else if (op.params[0] == NN){
-            //
-            //exit(-1);
-            dstValue = bus::read(regPC + 1);
-            dstValue |= bus::read(regPC + 2) << 8;
-            
+    } else if constexpr (MODE == ATypeAR) {
+        reg8<DST>(m) = bus::read(m, address<SRC>(m));
+    } else if constexpr (MODE == ATypeSP) {
+        if constexpr (DST == HL) {
+            char i = (char)bus::read(m, m.cpu.regPC + 1);
+            setReg16Value(m.cpu.regHL, getReg16Value(m.cpu.regSP) + i);
+
+            setFlag(m, FlagN, 0);
+            setFlag(m, FlagZ, 0);
+            setFlag(m, FlagC, ((getReg16Value(m.cpu.regSP)+i)&0xFF) < (getReg16Value(m.cpu.regSP)&0xFF));
+            setFlag(m, FlagH, ((getReg16Value(m.cpu.regSP)+i)&0xF) < (getReg16Value(m.cpu.regSP)&0xF));
         } else {
-            cout << "Unknown LD Dest Type " << endl;
-            exit(-1);
+            setReg16Value(m.cpu.regSP, getReg16Value(m.cpu.regHL));
         }
     } else {
-        dst = dit->second.first;
-        dstType = dit->second.second;
-
-        switch(dstType) {
-            case RPT16: {
-                ushort *p = (ushort *)dst;
-                dstValue = *p;
-            } break;
-            case RPTHi: {
-                dstValue = dst->hi;
-            } break;
-            case RPTLo: {
-                dstValue = dst->lo;
-            } break;
-        }
+        static_assert(unhandled<MODE>, "invalid LD addressing mode");
     }
 
-    switch(op.mode) {
-        case ATypeRA: {
-
-            ushort addr = getAddrValue(op.params[0], dstValue);
-
-            if (srcType == RPT16) {
-                bus::write(addr, srcValue);
-            } else {
-                bus::write(addr, (byte)srcValue);
-            }
-        }
-            break;
-        case ATypeAR: {
-            ushort addr = getAddrValue(op.params[1], srcValue);
-
-            if (dstType == RPTLo) {
-                dst->lo = bus::read(addr); ;
-            } else if (dstType == RPTHi) {
-                dst->hi = bus::read(addr); ;
-            } else {
-                *((ushort *)dst) = bus::read(addr); ;
-            }
-            
-            break;
-        } break;
-        case ATypeRR:
-        case ATypeIR:
-            {
-                if (dstType == RPTLo) {
-                    dst->lo = srcValue;
-                } else if (dstType == RPTHi) {
-                    dst->hi = srcValue;
-                } else {
-                    *((ushort *)dst) = srcValue;
-                }
-            } break;
-
-        case ATypeSP:
-        {
-            if (op.params[0] == HL) {
-                char i = (char)bus::read(regPC + 1);
-                setReg16Value(regHL, getReg16Value(regSP) + i);
-
-                setFlag(FlagN, 0);
-                setFlag(FlagZ, 0);
-                setFlag(FlagC, ((getReg16Value(regSP)+i)&0xFF) < (getReg16Value(regSP)&0xFF));
-                setFlag(FlagH, ((getReg16Value(regSP)+i)&0xF) < (getReg16Value(regSP)&0xF));
-                
-            } else {
-                setReg16Value(regSP, getReg16Value(regHL));
-            }
-        } break;
-
-        default:
-            cout << "INVALID OP FLAG: " << dstValue << endl;
-            exit(-1);
-            return 0;
-            
-    }
     return 0;
-
 }
 
-int handleNOP(const OpCode &op) {
-    //cout << " NOP " << endl;
-    //sleep(1);
+int handleNOP(Machine &m, const OpCode &op) {
     return 0;
-
 }
 
-int handleCB(const OpCode &op) {
-    int code = bus::read(regPC + 1);
-    byte reg = code & 7;
-    byte bitOp = (code >> 6) & 3;
-    byte bit = (code >> 3) & 7;
-    byte *pReg = regFromBits(reg);
-
-    if (bitOp) {
-        switch(bitOp) {
-            case 1:
-                setFlag(FlagZ, !((*pReg) & (1 << bit)));
-                setFlag(FlagN, false);
-                setFlag(FlagH, true);
-                break;
-            case 2:
-                (*pReg) &= ~(1 << bit);
-                break;
-            case 3:
-                (*pReg) |= (1 << bit);
-                break;
-            default:
-                cout << "INVALID BIT " << endl;
-                exit(-1);
-        }
-
-        return 0;
-    }
-
-    bitOp = bit;
-    int cBit = getFlag(FlagC);
-
-    //cout << "BIT OP: " << Byte(bitOp) << endl;
-
-    switch (bitOp) {
-        case 0: //RLC
-            //(*pReg) <<= (1 + getFlag(FlagC));
-            {
-                byte old = !!((*pReg) & 0x80);
-                (*pReg) <<= 1;
-                (*pReg) |= old;
-                setFlag(FlagC, old);
-                setFlag(FlagZ, !(*pReg));
-            }
-            break;
-        case 1: //RRC
-            //(*pReg) >>= (1 + getFlag(FlagC));
-            {
-                byte old = !!((*pReg) & 1);
-                (*pReg) >>= 1;
-                setFlag(FlagC, old);
-                (*pReg) |= (old << 7);
-                setFlag(FlagZ, !(*pReg));
-            }
-            break;
-        case 2: //RL
-            setFlag(FlagC, !!((*pReg) & 0x80));
-            (*pReg) <<= 1;
-            (*pReg) |= cBit;
-            setFlag(FlagZ, !(*pReg));
-            break;
-        case 3: //RR
-           // (*pReg) >>= 1;
-            setFlag(FlagC, (*pReg) & 1);
-            (*pReg) >>= 1;
-            (*pReg) |= (cBit << 7);
-            setFlag(FlagZ, !(*pReg));
-            break;
-        case 4: //SLA
-            setFlag(FlagC, !!((*pReg) & 0x80));
-            (*pReg) <<= 1;
-            setFlag(FlagZ, !(*pReg));
-            //(*pReg) |= cBit;
-            break;
-        case 5: //SRA 
-            {
-            setFlag(FlagC, (*pReg) & 1);
-            byte old = (*pReg) & 0x80;
-            (*pReg) >>= 1;
-            (*pReg) |= old;
-            setFlag(FlagZ, !(*pReg));
-        }break;
-        case 7: //SRL
-            setFlag(FlagC, (*pReg) & 1);
-            //cout << "SLR " << Byte(*pReg);
-            (*pReg) >>= 1;
-            setFlag(FlagZ, !(*pReg));
-            //cout << " = " << Byte(*pReg) << endl;
-            break;
-        case 6: //SWAP
-            //setFlag(FlagC, 0);
-            (*pReg) = (((*pReg) & 0xF0) >> 4) | (((*pReg) & 0xF) << 4);
-            regAF.lo = (!(*pReg)) << 7;
-            break;
-        default:
-            cout << "INVALID BIT2 " << endl;
-            exit(-1);
-    }
-
-    setFlag(FlagH, 0);
-    setFlag(FlagN, 0);
+int handleUnknown(Machine &m, const OpCode &op) {
+    cout << "UNKNOWN OP CODE: " << Byte(op.value) << endl;
+    exit(-1);
     return 0;
-
 }
 
-int conditionalJump(ushort location, const OpCode &op, bool &didJump) {
-    int diff = jumpCycleMap[op.value];
+//CB register field: 0-7 = B, C, D, E, H, L, (HL), A
+constexpr ParamType cbRegs[8] = {B, C, D, E, H, L, HL, A};
 
-    if (op.mode == ATypeJ) {
-        regPC = location;
-        didJump = true;
+template<byte CODE>
+int handleCBOp(Machine &m, const OpCode &op) {
+    constexpr ParamType reg = cbRegs[CODE & 7];
+    constexpr byte bitOp = (CODE >> 6) & 3;
+    constexpr byte bit = (CODE >> 3) & 7;
+    byte val = read8<reg>(m);
+
+    if constexpr (bitOp == 1) {
+        setFlag(m, FlagZ, !(val & (1 << bit)));
+        setFlag(m, FlagN, false);
+        setFlag(m, FlagH, true);
         return 0;
-    } else if (op.mode == ATypeJ_C && getFlag(FlagC)) {
-        regPC = location;
-        didJump = true;
-        return diff;
-    } else if (op.mode == ATypeJ_NC && !getFlag(FlagC)) {
-        regPC = location;
-        didJump = true;
-        return diff;
-    } else if (op.mode == ATypeJ_NZ && !getFlag(FlagZ)) {
-        regPC = location;
-        didJump = true;
-        return diff;
-    } else if (op.mode == ATypeJ_Z && getFlag(FlagZ)) {
-        regPC = location;
+    } else if constexpr (bitOp == 2) {
+        write8<reg>(m, val & ~(1 << bit));
+        return 0;
+    } else if constexpr (bitOp == 3) {
+        write8<reg>(m, val | (1 << bit));
+        return 0;
+    }
+
+    int cBit = getFlag(m, FlagC);
+
+    if constexpr (bit == 0) { //RLC
+        byte old = !!(val & 0x80);
+        val <<= 1;
+        val |= old;
+        setFlag(m, FlagC, old);
+        setFlag(m, FlagZ, !val);
+    } else if constexpr (bit == 1) { //RRC
+        byte old = !!(val & 1);
+        val >>= 1;
+        setFlag(m, FlagC, old);
+        val |= (old << 7);
+        setFlag(m, FlagZ, !val);
+    } else if constexpr (bit == 2) { //RL
+        setFlag(m, FlagC, !!(val & 0x80));
+        val <<= 1;
+        val |= cBit;
+        setFlag(m, FlagZ, !val);
+    } else if constexpr (bit == 3) { //RR
+        setFlag(m, FlagC, val & 1);
+        val >>= 1;
+        val |= (cBit << 7);
+        setFlag(m, FlagZ, !val);
+    } else if constexpr (bit == 4) { //SLA
+        setFlag(m, FlagC, !!(val & 0x80));
+        val <<= 1;
+        setFlag(m, FlagZ, !val);
+    } else if constexpr (bit == 5) { //SRA
+        setFlag(m, FlagC, val & 1);
+        byte old = val & 0x80;
+        val >>= 1;
+        val |= old;
+        setFlag(m, FlagZ, !val);
+    } else if constexpr (bit == 6) { //SWAP
+        val = ((val & 0xF0) >> 4) | ((val & 0xF) << 4);
+        m.cpu.regAF.lo = (!val) << 7;
+    } else { //SRL
+        setFlag(m, FlagC, val & 1);
+        val >>= 1;
+        setFlag(m, FlagZ, !val);
+    }
+
+    write8<reg>(m, val);
+
+    setFlag(m, FlagH, 0);
+    setFlag(m, FlagN, 0);
+    return 0;
+}
+
+template<std::size_t... I>
+constexpr std::array<HANDLER, sizeof...(I)> buildCBTable(std::index_sequence<I...>) {
+    return {{ handleCBOp<(byte)I>... }};
+}
+
+constexpr std::array<HANDLER, 256> cbHandlers = buildCBTable(std::make_index_sequence<256>{});
+
+int handleCB(Machine &m, const OpCode &op) {
+    return cbHandlers[bus::read(m, m.cpu.regPC + 1)](m, op);
+}
+
+template<AddrType MODE>
+inline bool condition(Machine &m) {
+    if constexpr (MODE == ATypeJ) return true;
+    else if constexpr (MODE == ATypeJ_C) return getFlag(m, FlagC);
+    else if constexpr (MODE == ATypeJ_NC) return !getFlag(m, FlagC);
+    else if constexpr (MODE == ATypeJ_NZ) return !getFlag(m, FlagZ);
+    else if constexpr (MODE == ATypeJ_Z) return getFlag(m, FlagZ);
+    else static_assert(unhandled<MODE>, "not a jump condition");
+}
+
+template<AddrType MODE, int TAKEN>
+int conditionalJump(Machine &m, ushort location, bool &didJump) {
+    if (condition<MODE>(m)) {
+        m.cpu.regPC = location;
         didJump = true;
-        return diff;
+        return MODE == ATypeJ ? 0 : TAKEN;
     }
 
     return 0;
 }
 
-int handleJumpRelative(const OpCode &op) {
-    char b = bus::read(regPC + 1);
-
-    if ((byte)b == 0xfe) {
-        cout << "INF LOOP? " << endl;
-        sleep(5);
-    }
-
-    ushort location = regPC + b;
+template<AddrType MODE, int TAKEN>
+int handleJumpRelative(Machine &m, const OpCode &op) {
+    char b = bus::read(m, m.cpu.regPC + 1);
+    ushort location = m.cpu.regPC + b;
     bool didJump;
 
-    return conditionalJump(location, op, didJump);
+    return conditionalJump<MODE, TAKEN>(m, location, didJump);
 }
 
-int handleJump(const OpCode &op) {
+template<ParamType P, AddrType MODE, int TAKEN>
+int handleJump(Machine &m, const OpCode &op) {
     ushort location = 0;
     bool didJump;
 
-    switch(op.params[0]) {
-        case NN:
-            location = toShort(bus::read(regPC + 1), bus::read(regPC + 2));
-            break;
-        case HL:
-            location = toShort(regHL.lo, regHL.hi);
-            break;
-        default:
-            cout << "ERRO BAD JUMP" << endl;
-            exit(-1);
-
+    if constexpr (P == NN) {
+        location = readImm16(m);
+    } else if constexpr (P == HL) {
+        location = toShort(m.cpu.regHL.lo, m.cpu.regHL.hi);
+    } else {
+        static_assert(unhandled<P>, "bad jump operand");
     }
 
-    return conditionalJump(location - op.length, op, didJump);
-
-/*
-    if (op.mode == ATypeJ) {
-        regPC = location - op.length;
-        return 0;
-    } else if (op.mode == ATypeJ_C && getFlag(FlagC)) {
-        regPC = location - op.length;
-        return 4;
-    } else if (op.mode == ATypeJ_NC && !getFlag(FlagC)) {
-        regPC = location - op.length;
-        return 4;
-    } else if (op.mode == ATypeJ_NZ && !getFlag(FlagZ)) {
-        regPC = location - op.length;
-        return 4;
-    } else if (op.mode == ATypeJ_Z && getFlag(FlagZ)) {
-        regPC = location - op.length;
-        return 4;
-    }
-    return 0;
-*/
+    return conditionalJump<MODE, TAKEN>(m, location - op.length, didJump);
 }
 
-int handleDAA(const OpCode &op) {
-    if (!getFlag(FlagN)) {
-        ushort a = regAF.hi;
-        byte nl = (regAF.hi & 0x0f);
+int handleDAA(Machine &m, const OpCode &op) {
+    if (!getFlag(m, FlagN)) {
+        ushort a = m.cpu.regAF.hi;
+        byte nl = (m.cpu.regAF.hi & 0x0f);
         bool finalVal = false;
-        
-        if (getFlag(FlagH) || nl > 0x09) {
+
+        if (getFlag(m, FlagH) || nl > 0x09) {
             a += 6;
         }
 
-        if (getFlag(FlagC) || (a & 0xFFF0) > 0x90) {
+        if (getFlag(m, FlagC) || (a & 0xFFF0) > 0x90) {
             a += 0x60;
             finalVal = true;
         }
 
-        regAF.hi = (byte)(a & 0xFF);
-        setFlag(FlagC, finalVal);
+        m.cpu.regAF.hi = (byte)(a & 0xFF);
+        setFlag(m, FlagC, finalVal);
     } else {
-        if (getFlag(FlagH)) {
-            regAF.hi -= 6;
+        if (getFlag(m, FlagH)) {
+            m.cpu.regAF.hi -= 6;
         }
 
-        if (getFlag(FlagC)) {
-            regAF.hi -= 0x60;
+        if (getFlag(m, FlagC)) {
+            m.cpu.regAF.hi -= 0x60;
         } else {
-            setFlag(FlagC, false);
+            setFlag(m, FlagC, false);
         }
     }
 
-    setFlag(FlagZ, regAF.hi == 0);
-    setFlag(FlagH, false);
+    setFlag(m, FlagZ, m.cpu.regAF.hi == 0);
+    setFlag(m, FlagH, false);
     return 0;
 }
 
 
-ushort lastCallAddress = 0;
-
-int handlePOP(const OpCode &op) {
-    ushort *p = (ushort *)getPointer(op.params[0], false);
-    
-    ushort s = spop();
-    cout << "POPPED VALUE: " << Short(s) << endl;
+template<ParamType P>
+int handlePOP(Machine &m, const OpCode &op) {
+    ushort s = spop(m);
+    if (DEBUG) cout << "POPPED VALUE: " << Short(s) << endl;
 
-    if (p == (ushort *)&regAF) {
-        *p = s & 0xFFF0;
+    if constexpr (P == AF) {
+        reg16<P>(m) = s & 0xFFF0;
     } else {
-        *p = s;
+        reg16<P>(m) = s;
     }
 
-    if (op.value == 0xF1) {
-        //sleep(2);
-    }
-    
     return 0;
 }
 
-int handlePUSH(const OpCode &op) {
-    ushort *p = (ushort *)getPointer(op.params[0], false);
-
-    push(*p);
+template<ParamType P>
+int handlePUSH(Machine &m, const OpCode &op) {
+    push(m, reg16<P>(m));
 
-    cout << "PUSHED: " << Short(*p) << endl;
+    if (DEBUG) cout << "PUSHED: " << Short(reg16<P>(m)) << endl;
 
     return 0;
 }
 
-int callSize = 0;
-
-extern vector<byte> THESTACK;
-
-int handleCALL(const OpCode &op) {
-    ushort lca = regPC + op.length;
-    bool didJump;
-    ushort location = toShort(bus::read(regPC + 1), bus::read(regPC + 2)) - op.length;
-    //lastCallAddress = regPC + op.length;
-
-    //for (int i=0; i<callSize; i++) {
-    //    cout << " ";
-    //}
-
-    //char sz[256];
-    //sprintf("%%dc", callSize);
-
-    callSize++;
-
-    if (callSize > 30) {
-        callSize = callSize + 0;
+void printStack(Machine &m) {
+    for (size_t i=0; i<m.cpu.stack.size(); i++) {
+        cout << Byte(m.cpu.stack[i]) << "-";
     }
 
-    cout << std::setfill('-') << std::setw(callSize) << "-" << "HANDLING CALL: " << Short(regPC) << " CALLSIZE: " << callSize << " STACK: ";
+    cout << endl;
+}
+
+template<AddrType MODE, int TAKEN>
+int handleCALL(Machine &m, const OpCode &op) {
+    ushort lca = m.cpu.regPC + op.length;
+    bool didJump = false;
+    ushort location = readImm16(m) - op.length;
 
+    m.cpu.callSize++;
 
-    if (regPC == 0x2200) {
-        regPC += 0;
-    }
+    if (DEBUG) cout << std::setfill('-') << std::setw(m.cpu.callSize) << "-" << "HANDLING CALL: " << Short(m.cpu.regPC) << " CALLSIZE: " << m.cpu.callSize << " STACK: ";
 
-    int ret = conditionalJump(location, op, didJump);
+    int ret = conditionalJump<MODE, TAKEN>(m, location, didJump);
 
     if (didJump) {
-        cpu::push((ushort)(lca));
-        lastCallAddress = lca;
-    } else {
+        push(m, (ushort)(lca));
+    } else if (DEBUG) {
         cout << "NO" << endl;
     }
 
-    for (size_t i=0; i<THESTACK.size(); i++) {
-        cout << Byte(THESTACK[i]) << "-";
-    }
-    
-    cout << endl;
+    if (DEBUG) printStack(m);
 
     return ret;
 }
 
-bool cameFromI = false;
-
-int handleRET(const OpCode &op) {
+template<AddrType MODE, int TAKEN>
+int handleRET(Machine &m, const OpCode &op) {
     bool didJump = false;
-    ushort location = cpu::spop();
-
-    //cout << "HANDLING RET: " << Short(lastCallAddress) << " - " << Short(location) << endl;
-    int ret = conditionalJump(location - 1, op, didJump);
+    ushort location = spop(m);
 
-    
-    if (regPC == 0x3017) {
-        regPC = regPC + 0;
-    }
+    int ret = conditionalJump<MODE, TAKEN>(m, location - 1, didJump);
 
     if (didJump) {
-        cout << std::setfill('-') << std::setw(callSize) << "-" << "RET - AFTER RET: " << ret << " - " << Short(regPC) << " / " << Short(location) << " CALLSIZE: " << callSize << " STACK: ";
-
-        if (!cameFromI) {
-            //for (int i=0; i<callSize; i++) {
-            //    cout << " ";
-            //}
+        if (DEBUG) cout << std::setfill('-') << std::setw(m.cpu.callSize) << "-" << "RET - AFTER RET: " << ret << " - " << Short(m.cpu.regPC) << " / " << Short(location) << " CALLSIZE: " << m.cpu.callSize << " STACK: ";
 
-            callSize--;
+        if (!m.cpu.cameFromI) {
+            m.cpu.callSize--;
         }
 
-        if (callSize < 0) {
+        if (DEBUG && m.cpu.callSize < 0) {
             cout << "OOPS" << endl;
         }
 
-        for (size_t i=0; i<THESTACK.size(); i++) {
-            cout << Byte(THESTACK[i]) << "-";
-        }
-        
-        cout << endl;
+        if (DEBUG) printStack(m);
     }
 
     if (!didJump) {
-        cpu::push(location);
+        push(m, location);
     }
 
     return ret;
 }
 
-int handleRETI(const OpCode &op) {
-    interruptsEnabled = true;
-    cameFromI = true;
-    int n = handleRET(op);
-    cameFromI = false;
-
-    //cout << "RETI - AFTER RET: " << n << " - " << Short(regPC) << endl;
+template<AddrType MODE, int TAKEN>
+int handleRETI(Machine &m, const OpCode &op) {
+    m.cpu.interruptsEnabled = true;
+    m.cpu.cameFromI = true;
+    int n = handleRET<MODE, TAKEN>(m, op);
+    m.cpu.cameFromI = false;
 
     return n;
 }
 
-void setFlags(byte first, byte second, bool add, bool withCarry) {
+void setFlags(Machine &m, byte first, byte second, bool add, bool withCarry) {
     if (add) {
-        unsigned int a = first + second + (withCarry ? getFlag(FlagC) : 0);
-        byte cf = getFlag(FlagC);
-        //setFlag(FlagZ, (a & 0xFF) == 0);
-        setFlag(FlagZ, !(a & 0xFF));
-        //cout << "AF: 2: " << Byte(regAF.lo) << endl;
-        //setFlag(FlagC, a > 0xFF);
-        setFlag(FlagC, a >= 0x100);
-        //cout << "AF: 3: " << Byte(regAF.lo) << endl;
-        setFlag(FlagN, false);
-        //cout << "AF: 4: " << Byte(regAF.lo) << endl;
-        setFlag(FlagH, ((first&0xF) + (second&0xF) + (withCarry ? cf : 0)) >= 0x10);
-        //cout << "AF: 5: " << Byte(regAF.lo) << " - " << Short(a) << endl;
-        //setFlag(FlagH, (first & 0xF) + (second & 0xF) + (withCarry && getFlag(FlagC)) > 0xF);
+        unsigned int a = first + second + (withCarry ? getFlag(m, FlagC) : 0);
+        byte cf = getFlag(m, FlagC);
+        setFlag(m, FlagZ, !(a & 0xFF));
+        setFlag(m, FlagC, a >= 0x100);
+        setFlag(m, FlagN, false);
+        setFlag(m, FlagH, ((first&0xF) + (second&0xF) + (withCarry ? cf : 0)) >= 0x10);
     } else {
-        int a = first - second - (withCarry && getFlag(FlagC));
-        byte cf = getFlag(FlagC);
-        setFlag(FlagZ, (a & 0xFF) == 0);
-        setFlag(FlagC, a < 0);
-        setFlag(FlagN, true);
-        setFlag(FlagH, (first & 0xF) - (second & 0xF) - (withCarry ? cf : 0) < 0);
+        int a = first - second - (withCarry && getFlag(m, FlagC));
+        byte cf = getFlag(m, FlagC);
+        setFlag(m, FlagZ, (a & 0xFF) == 0);
+        setFlag(m, FlagC, a < 0);
+        setFlag(m, FlagN, true);
+        setFlag(m, FlagH, (first & 0xF) - (second & 0xF) - (withCarry ? cf : 0) < 0);
     }
 
     return;
 }
 
-int handleCP(const OpCode &op) { 
-    byte *val = getPointer(op.params[0]);
+template<ParamType P>
+int handleCP(Machine &m, const OpCode &op) {
+    byte val = read8<P>(m);
 
-    setFlags(regAF.hi, *val, false, false);
+    setFlags(m, m.cpu.regAF.hi, val, false, false);
     return 0;
 }
 
-int handleADC(const OpCode &op) {
-    byte *val = getPointer(op.params[1]);
-
-    if (op.value == 0xCE) {
-        byte t = bus::read(regPC + 1);
-        unsigned int i = regAF.hi + t + getFlag(FlagC) >= 0x100;
-        //setFlags(regAF.hi, t, true, true);
-        setFlag(FlagN, false);
-        setFlag(FlagH, ((regAF.hi&0xF) + (t&0xF) + getFlag(FlagC)) >= 0x10);
-        regAF.hi = regAF.hi + t + getFlag(FlagC);
-        setFlag(FlagC, i);
-        setFlag(FlagZ, !regAF.hi);
-
-        return  0;
-    }
+template<ParamType P>
+int handleADC(Machine &m, const OpCode &op) {
+    byte val = read8<P>(m);
 
-    unsigned int a = regAF.hi + *val + getFlag(FlagC);
+    unsigned int a = m.cpu.regAF.hi + val + getFlag(m, FlagC);
 
-    setFlags(regAF.hi, *val, true, true);
+    setFlags(m, m.cpu.regAF.hi, val, true, true);
 
-    regAF.hi = a & 0xFF;
+    m.cpu.regAF.hi = a & 0xFF;
     return 0;
 }
 
-int handleADD(const OpCode &op) {
-    if (op.params[0] == A) {
-        byte *p = getPointer(op.params[1]);
-        ushort a = regAF.hi + *p;
-        setFlags(regAF.hi, *p, true, false);
-        regAF.hi = a & 0x00FF;
-
-    } else if (op.params[0] == SP) {
-        char e = bus::read(regPC + 1);
-        setFlags(getReg16Value(regSP), e, true, false);
-        setReg16Value(regSP, getReg16Value(regSP) + e);
-        setFlag(FlagZ, false);
+template<ParamType DST, ParamType SRC>
+int handleADD(Machine &m, const OpCode &op) {
+    if constexpr (DST == A) {
+        byte val = read8<SRC>(m);
+        ushort a = m.cpu.regAF.hi + val;
+        setFlags(m, m.cpu.regAF.hi, val, true, false);
+        m.cpu.regAF.hi = a & 0x00FF;
+
+    } else if constexpr (DST == SP) {
+        char e = bus::read(m, m.cpu.regPC + 1);
+        setFlags(m, getReg16Value(m.cpu.regSP), e, true, false);
+        setReg16Value(m.cpu.regSP, getReg16Value(m.cpu.regSP) + e);
+        setFlag(m, FlagZ, false);
     } else {
-        ushort *p = (ushort *)getPointer(op.params[1], false);
-        ushort *pHL = (ushort *)&regHL;
-        int n = *pHL + *p;
+        ushort val = reg16<SRC>(m);
+        ushort *pHL = (ushort *)&m.cpu.regHL;
+        int n = *pHL + val;
 
-        setFlag(FlagC, n >= 0x10000);
-        setFlag(FlagN, false);
-        setFlag(FlagH, (n & 0xFFF) < (*pHL & 0xFFF));
+        setFlag(m, FlagC, n >= 0x10000);
+        setFlag(m, FlagN, false);
+        setFlag(m, FlagH, (n & 0xFFF) < (*pHL & 0xFFF));
         *pHL = n & 0xFFFF;
     }
 
     return 0;
 }
 
-int handleSUB(const OpCode &op) {
-    byte *val = getPointer(op.params[0]);
+template<ParamType P>
+int handleSUB(Machine &m, const OpCode &op) {
+    byte val = read8<P>(m);
 
-    short a = regAF.hi - *val;
-    setFlags(regAF.hi, *val, false, false);
+    short a = m.cpu.regAF.hi - val;
+    setFlags(m, m.cpu.regAF.hi, val, false, false);
 
-    regAF.hi = a & 0x00FF;
+    m.cpu.regAF.hi = a & 0x00FF;
     return 0;
 }
 
-int handleSBC(const OpCode &op) {
-    byte *val = getPointer(op.params[0]);
+template<ParamType P>
+int handleSBC(Machine &m, const OpCode &op) {
+    byte val = read8<P>(m);
 
-    short a = regAF.hi - *val - getFlag(FlagC);
-    setFlags(regAF.hi, *val, false, true);
+    short a = m.cpu.regAF.hi - val - getFlag(m, FlagC);
+    setFlags(m, m.cpu.regAF.hi, val, false, true);
 
-    regAF.hi = a & 0x00FF;
+    m.cpu.regAF.hi = a & 0x00FF;
     return 0;
 }
 
-int handleAND(const OpCode &op) {
-    byte *val = getPointer(op.params[0]);
+template<ParamType P>
+int handleAND(Machine &m, const OpCode &op) {
+    m.cpu.regAF.hi &= read8<P>(m);
 
-    regAF.hi &= *val;
-    
-    setFlag(FlagZ, regAF.hi == 0);
-    setFlag(FlagN, false);
-    setFlag(FlagH, true);
-    setFlag(FlagC, 0);
+    setFlag(m, FlagZ, m.cpu.regAF.hi == 0);
+    setFlag(m, FlagN, false);
+    setFlag(m, FlagH, true);
+    setFlag(m, FlagC, 0);
     return 0;
 }
 
-int handleOR(const OpCode &op) {
-    byte *val = getPointer(op.params[0]);
+template<ParamType P>
+int handleOR(Machine &m, const OpCode &op) {
+    m.cpu.regAF.hi |= read8<P>(m);
 
-    regAF.hi |= *val;
-    
-    setFlag(FlagZ, regAF.hi == 0);
-    setFlag(FlagN, false);
-    setFlag(FlagH, false);
-    setFlag(FlagC, 0);
+    setFlag(m, FlagZ, m.cpu.regAF.hi == 0);
+    setFlag(m, FlagN, false);
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagC, 0);
     return 0;
 }
 
-int handleXOR(const OpCode &op) {
-    byte *val = getPointer(op.params[0]);
+template<ParamType P>
+int handleXOR(Machine &m, const OpCode &op) {
+    m.cpu.regAF.hi ^= read8<P>(m);
 
-    //cout << "XORING VAL: " << Byte(*val) << endl;
-
-    regAF.hi ^= *val;
-    
-    setFlag(FlagZ, regAF.hi == 0);
-    setFlag(FlagN, false);
-    setFlag(FlagH, false);
-    setFlag(FlagC, 0);
+    setFlag(m, FlagZ, m.cpu.regAF.hi == 0);
+    setFlag(m, FlagN, false);
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagC, 0);
     return 0;
 }
 
-byte getVal(ParamType pt) {
-    switch(pt) {
-        case A: return regAF.hi; 
-        case B: return regBC.hi; 
-        case C: return regBC.lo; 
-        case D: return regDE.hi; 
-        case E: return regDE.lo; 
-        case H: return regHL.hi; 
-        case L: return regHL.lo; 
-        case N: return bus::read(regPC + 1); 
-        case HL: return bus::read(toShort(regHL.lo, regHL.hi)); break;
-        default:
-            cout << "BAD LDD" << endl;
-            exit(-1);
-            return 0;
-    }
-}
-
-int handleLDD(const OpCode &op) {
-    handleLD(op);
-    ushort *p = (ushort *)&regHL;
+template<ParamType DST, ParamType SRC, AddrType MODE>
+int handleLDD(Machine &m, const OpCode &op) {
+    handleLD<DST, SRC, MODE>(m, op);
+    ushort *p = (ushort *)&m.cpu.regHL;
     (*p)--;
     return 0;
 }
 
-int handleLDI(const OpCode &op) {
-    handleLD(op);
-    ushort *p = (ushort *)&regHL;
+template<ParamType DST, ParamType SRC, AddrType MODE>
+int handleLDI(Machine &m, const OpCode &op) {
+    handleLD<DST, SRC, MODE>(m, op);
+    ushort *p = (ushort *)&m.cpu.regHL;
     (*p)++;
     return 0;
 }
 
-int handleINC(const OpCode &op) {
-    ushort val = 0;
-    ushort prev = 0;
-
-    switch(op.params[0]) {
-        case A: prev = regAF.hi++; val = regAF.hi; break;
-        case B: prev = regBC.hi++; val = regBC.hi; break;
-        case C: prev = regBC.lo++; val = regBC.lo; break;
-        case D: prev = regDE.hi++; val = regDE.hi; break;
-        case E: prev = regDE.lo++; val = regDE.lo; break;
-        case H: prev = regHL.hi++; val = regHL.hi; break;
-        case L: prev = regHL.lo++; val = regHL.lo; break;
-        case BC: prev = (*getReg16Pointer(regBC))++; val = (getReg16Value(regBC));  return 0;
-        case DE: prev = (*getReg16Pointer(regDE))++; val = (getReg16Value(regDE)); return 0;
-        case SP: prev = (*getReg16Pointer(regSP))++; val = (getReg16Value(regSP)); return 0;
-        case HL: {
-            if (op.mode == ATypeA) {
-                byte b = bus::read((getReg16Value(regHL)));
-                prev = b++;
-                bus::write((getReg16Value(regHL)), b);
-                val = b;
-
-            } else {
-                prev = (*getReg16Pointer(regHL))++; 
-                val = (getReg16Value(regHL)); 
-                return 0;
-            }
-        } break;
-        default:
-            cout << "INVALID INC FLAG" << endl;
-            exit(-1);
-            return 0;
-    }
+template<ParamType P, AddrType MODE>
+int handleINC(Machine &m, const OpCode &op) {
+    if constexpr (P == BC || P == DE || P == SP || (P == HL && MODE != ATypeA)) {
+        reg16<P>(m)++;
+        return 0;
+    } else {
+        byte prev = read8<P>(m);
+        byte val = prev + 1;
+        write8<P>(m, val);
 
-    setFlag(FlagZ, val == 0);
-    setFlag(FlagN, 0);
-    setFlag(FlagH, (prev & 0xF) == 0xF);
-    return 0;
+        setFlag(m, FlagZ, val == 0);
+        setFlag(m, FlagN, 0);
+        setFlag(m, FlagH, (prev & 0xF) == 0xF);
+        return 0;
+    }
 }
 
-int handleDEC(const OpCode &op) {
-    ushort val = 0;
-
-    switch(op.params[0]) {
-        case A: regAF.hi--; val = regAF.hi; break;
-        case B: regBC.hi--; val = regBC.hi; break;
-        case C: regBC.lo--; val = regBC.lo; break;
-        case D: regDE.hi--; val = regDE.hi; break;
-        case E: regDE.lo--; val = regDE.lo; break;
-        case H: regHL.hi--; val = regHL.hi; break;
-        case L: regHL.lo--; val = regHL.lo; break;
-        case BC: (*getReg16Pointer(regBC))--; val = (getReg16Value(regBC)); return 0;
-        case DE: (*getReg16Pointer(regDE))--; val = (getReg16Value(regDE)); return 0;
-        case SP: (*getReg16Pointer(regSP))--; val = (getReg16Value(regSP)); return 0;
-        case HL: {
-            if (op.mode == ATypeA) {
-                byte b = bus::read((getReg16Value(regHL)));
-                b--;
-                bus::write((getReg16Value(regHL)), b);
-                val = b;
-            } else {
-                (*getReg16Pointer(regHL))--; 
-                val = (getReg16Value(regHL)); 
-                return 0;
-            }
-        } break;
-        default:
-            cout << "INVALID DEC FLAG" << endl;
-            exit(-1);
-            return 0;
-    }
+template<ParamType P, AddrType MODE>
+int handleDEC(Machine &m, const OpCode &op) {
+    if constexpr (P == BC || P == DE || P == SP || (P == HL && MODE != ATypeA)) {
+        reg16<P>(m)--;
+        return 0;
+    } else {
+        byte val = read8<P>(m) - 1;
+        write8<P>(m, val);
 
-    setFlag(FlagZ, val == 0);
-    setFlag(FlagN, 1);
-    setFlag(FlagH, (val & 0xF) == 0x0F);
-    return 0;
+        setFlag(m, FlagZ, val == 0);
+        setFlag(m, FlagN, 1);
+        setFlag(m, FlagH, (val & 0xF) == 0x0F);
+        return 0;
+    }
 }
 
-int handleRLA(const OpCode &op) {
-    byte cf = getFlag(FlagC);
-    setFlag(FlagC, !!(regAF.hi & (1 << 7)));
-    regAF.hi <<= 1;
-    regAF.hi += cf;
-    setFlag(FlagZ, false);
-    setFlag(FlagH, false);
-    setFlag(FlagN, false);
+int handleRLA(Machine &m, const OpCode &op) {
+    byte cf = getFlag(m, FlagC);
+    setFlag(m, FlagC, !!(m.cpu.regAF.hi & (1 << 7)));
+    m.cpu.regAF.hi <<= 1;
+    m.cpu.regAF.hi += cf;
+    setFlag(m, FlagZ, false);
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagN, false);
     return 0;
 }
 
-int handleRLCA(const OpCode &op) {
-    byte b = !!(regAF.hi & 0x80);
-    regAF.hi <<= 1;
-    regAF.hi |= b;
-    
-    setFlag(FlagC, b);
-    setFlag(FlagZ, false);
-    setFlag(FlagH, false);
-    setFlag(FlagN, false);
+int handleRLCA(Machine &m, const OpCode &op) {
+    byte b = !!(m.cpu.regAF.hi & 0x80);
+    m.cpu.regAF.hi <<= 1;
+    m.cpu.regAF.hi |= b;
+
+    setFlag(m, FlagC, b);
+    setFlag(m, FlagZ, false);
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagN, false);
 
     return 0;
 }
 
-int handleRRA(const OpCode &op) {
-    byte carry = getFlag(FlagC);
+int handleRRA(Machine &m, const OpCode &op) {
+    byte carry = getFlag(m, FlagC);
 
-    setFlag(FlagC, regAF.hi & 1);
-    regAF.hi >>= 1;
-    regAF.hi |= (carry << 7);
-    setFlag(FlagZ, false);
-    setFlag(FlagH, false);
-    setFlag(FlagN, false);
+    setFlag(m, FlagC, m.cpu.regAF.hi & 1);
+    m.cpu.regAF.hi >>= 1;
+    m.cpu.regAF.hi |= (carry << 7);
+    setFlag(m, FlagZ, false);
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagN, false);
 
     return 0;
 }
 
-int handleCPL(const OpCode &op) {
-    regAF.hi = ~regAF.hi;
-    setFlag(FlagH, true);
-    setFlag(FlagN, true);
+int handleCPL(Machine &m, const OpCode &op) {
+    m.cpu.regAF.hi = ~m.cpu.regAF.hi;
+    setFlag(m, FlagH, true);
+    setFlag(m, FlagN, true);
     return 0;
 }
 
-int handleRRCA(const OpCode &op) {
-    byte b = regAF.hi & 1;
-    regAF.hi >>= 1;
-    regAF.hi |= b << 7;
-    
+int handleRRCA(Machine &m, const OpCode &op) {
+    byte b = m.cpu.regAF.hi & 1;
+    m.cpu.regAF.hi >>= 1;
+    m.cpu.regAF.hi |= b << 7;
+
     if (b) {
-        setFlag(FlagC, true);
+        setFlag(m, FlagC, true);
     } else {
-        setFlag(FlagC, false);
+        setFlag(m, FlagC, false);
     }
 
-    setFlag(FlagZ, false);
-    setFlag(FlagH, false);
-    setFlag(FlagN, false);
+    setFlag(m, FlagZ, false);
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagN, false);
 
     return 0;
 }
 
-int handleDI(const OpCode &op) {
-    interruptsEnabled = false;
+int handleDI(Machine &m, const OpCode &op) {
+    m.cpu.interruptsEnabled = false;
     return 0;
 }
 
-int handleEI(const OpCode &op) {
-    //interruptsEnabled = true;
-    eiCalled = true;
+int handleEI(Machine &m, const OpCode &op) {
+    m.cpu.eiCalled = true;
     return 0;
 }
 
-int handleSCF(const OpCode &op) {
-    setFlag(FlagH, false);
-    setFlag(FlagN, false);
-    setFlag(FlagC, true);
+int handleSCF(Machine &m, const OpCode &op) {
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagN, false);
+    setFlag(m, FlagC, true);
     return 0;
 }
 
-int handleCCF(const OpCode &op) {
-    setFlag(FlagH, false);
-    setFlag(FlagN, false);
-    setFlag(FlagC, !getFlag(FlagC));
+int handleCCF(Machine &m, const OpCode &op) {
+    setFlag(m, FlagH, false);
+    setFlag(m, FlagN, false);
+    setFlag(m, FlagC, !getFlag(m, FlagC));
     return 0;
 }
 
-int handleRST(const OpCode &op) {
-    push((ushort)(regPC + 1));
-
-    switch(op.params[0]) {
-        case x00: regPC = 0x00; break;
-        case x08: regPC = 0x08; break;
-        case x10: regPC = 0x10; break;
-        case x18: regPC = 0x18; break;
-        case x20: regPC = 0x20; break;
-        case x28: regPC = 0x28; break;
-        case x30: regPC = 0x30; break;
-        case x38: regPC = 0x38; break;
-        default: {
-            cout << "UNKNOWN RST" << endl;
-            exit(-1);
-        }
+constexpr ushort rstAddress(ParamType pt) {
+    switch(pt) {
+        case x00: return 0x00;
+        case x08: return 0x08;
+        case x10: return 0x10;
+        case x18: return 0x18;
+        case x20: return 0x20;
+        case x28: return 0x28;
+        case x30: return 0x30;
+        case x38: return 0x38;
+        default: return 0xFFFF;
     }
+}
 
-    regPC -= 1;
+template<ParamType P>
+int handleRST(Machine &m, const OpCode &op) {
+    static_assert(rstAddress(P) != 0xFFFF, "unknown RST vector");
+
+    push(m, (ushort)(m.cpu.regPC + 1));
+    m.cpu.regPC = rstAddress(P) - 1;
     return 0;
 }
 
-int handleHALT(const OpCode &opCode) {
-    haltWaitingForInterrupt = true;
+int handleHALT(Machine &m, const OpCode &opCode) {
+    m.cpu.haltWaitingForInterrupt = true;
     return 0;
 }
 
-void init_handlers() {
-    handlerMap[LD] = handleLD;
-    handlerMap[LDI] = handleLDI;
-    handlerMap[LDD] = handleLDD;
-    handlerMap[NOP] = handleNOP;
-    handlerMap[JP] = handleJump;
-    handlerMap[JR] = handleJumpRelative;
-    handlerMap[XOR] = handleXOR;
-    handlerMap[OR] = handleOR;
-    handlerMap[AND] = handleAND;
-    handlerMap[INC] = handleINC;
-    handlerMap[DEC] = handleDEC;
-    handlerMap[RRCA] = handleRRCA;
-    handlerMap[RRA] = handleRRA;
-    handlerMap[RLCA] = handleRLCA;
-    handlerMap[RLA] = handleRLA;
-
-    handlerMap[ADD] = handleADD;
-    handlerMap[ADC] = handleADC;
-    handlerMap[SUB] = handleSUB;
-    handlerMap[SBC] = handleSBC;
-    handlerMap[CP] = handleCP;
-    handlerMap[DI] = handleDI;
-    handlerMap[EI] = handleEI;
-    handlerMap[LDH] = handleLDH;
-    handlerMap[RST] = handleRST;
-    handlerMap[CALL] = handleCALL;
-    handlerMap[RET] = handleRET;
-    handlerMap[RETI] = handleRETI;
-    handlerMap[DAA] = handleDAA;
-    handlerMap[PUSH] = handlePUSH;
-    handlerMap[POP] = handlePOP;
-    handlerMap[CB] = handleCB;
-    handlerMap[CPL] = handleCPL;
-    handlerMap[HALT] = handleHALT;
-    handlerMap[SCF] = handleSCF;
-    handlerMap[CCF] = handleCCF;
-    handlerMap[STOP] = handleNOP;
-
-    initParamTypeMap();
+//unlike HALT no interrupt ends STOP, io::joypadChanged() does when a selected line goes low.
+int handleSTOP(Machine &m, const OpCode &opCode) {
+    m.cpu.haltWaitingForInterrupt = true;
+    m.cpu.stopped = true;
+    return 0;
 }
 
-int handle_op(OpCode &opCode) {
-    std::map<Op, HANDLER>::iterator it = handlerMap.find(opCode.op);
-
-    if (it == handlerMap.end()) {
-        cout << "UNKNOWN OP CODE: " << Byte(opCode.value) << endl;
-        exit(-1);
-    }
-
-    int ret = it->second(opCode);
-
-    if (opCode.op != EI && eiCalled) {
-        eiCalled = false;
-        interruptsEnabled = true;
+/*
+  One handler per opcode, with the operands from opCodes[] baked in as template
+  arguments so nothing is decoded at run time.
+*/
+template<byte OPC>
+int execute(Machine &m, const OpCode &op) {
+    constexpr OpCode def = opCodes[OPC];
+    constexpr ParamType P0 = def.params[0];
+    constexpr ParamType P1 = def.params[1];
+    constexpr AddrType M = def.mode;
+    constexpr int T = jumpCycles(OPC);
+
+    if constexpr (def.op == NOP) return handleNOP(m, op);
+    else if constexpr (def.op == STOP) return handleSTOP(m, op);
+    else if constexpr (def.op == LD) return handleLD<P0, P1, M>(m, op);
+    else if constexpr (def.op == LDI) return handleLDI<P0, P1, M>(m, op);
+    else if constexpr (def.op == LDD) return handleLDD<P0, P1, M>(m, op);
+    else if constexpr (def.op == LDH) return handleLDH<P0, P1>(m, op);
+    else if constexpr (def.op == JP) return handleJump<P0, M, T>(m, op);
+    else if constexpr (def.op == JR) return handleJumpRelative<M, T>(m, op);
+    else if constexpr (def.op == CALL) return handleCALL<M, T>(m, op);
+    else if constexpr (def.op == RET) return handleRET<M, T>(m, op);
+    else if constexpr (def.op == RETI) return handleRETI<M, T>(m, op);
+    else if constexpr (def.op == RST) return handleRST<P0>(m, op);
+    else if constexpr (def.op == XOR) return handleXOR<P0>(m, op);
+    else if constexpr (def.op == OR) return handleOR<P0>(m, op);
+    else if constexpr (def.op == AND) return handleAND<P0>(m, op);
+    else if constexpr (def.op == SUB) return handleSUB<P0>(m, op);
+    else if constexpr (def.op == SBC) return handleSBC<P0>(m, op);
+    else if constexpr (def.op == CP) return handleCP<P0>(m, op);
+    else if constexpr (def.op == ADD) return handleADD<P0, P1>(m, op);
+    else if constexpr (def.op == ADC) return handleADC<P1>(m, op);
+    else if constexpr (def.op == INC) return handleINC<P0, M>(m, op);
+    else if constexpr (def.op == DEC) return handleDEC<P0, M>(m, op);
+    else if constexpr (def.op == PUSH) return handlePUSH<P0>(m, op);
+    else if constexpr (def.op == POP) return handlePOP<P0>(m, op);
+    else if constexpr (def.op == RRCA) return handleRRCA(m, op);
+    else if constexpr (def.op == RRA) return handleRRA(m, op);
+    else if constexpr (def.op == RLCA) return handleRLCA(m, op);
+    else if constexpr (def.op == RLA) return handleRLA(m, op);
+    else if constexpr (def.op == DI) return handleDI(m, op);
+    else if constexpr (def.op == EI) return handleEI(m, op);
+    else if constexpr (def.op == DAA) return handleDAA(m, op);
+    else if constexpr (def.op == CB) return handleCB(m, op);
+    else if constexpr (def.op == CPL) return handleCPL(m, op);
+    else if constexpr (def.op == HALT) return handleHALT(m, op);
+    else if constexpr (def.op == SCF) return handleSCF(m, op);
+    else if constexpr (def.op == CCF) return handleCCF(m, op);
+    else return handleUnknown(m, op);
+}
+
+template<std::size_t... I>
+constexpr std::array<HANDLER, sizeof...(I)> buildTable(std::index_sequence<I...>) {
+    return {{ execute<(byte)I>... }};
+}
+
+constexpr std::array<HANDLER, 256> opHandlers = buildTable(std::make_index_sequence<256>{});
+
+int handle_op(Machine &m, const OpCode &opCode) {
+    int ret = opHandlers[opCode.value](m, opCode);
+
+    if (opCode.op != EI && m.cpu.eiCalled) {
+        m.cpu.eiCalled = false;
+        m.cpu.interruptsEnabled = true;
     }
 
     return ret;
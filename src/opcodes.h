@@ -1,9 +1,15 @@
 
+#pragma once
+
 #include "cpu.h"
 
 namespace dsemu::cpu {
 
-OpCode opCodes[] = {
+/*
+  Indexed directly by opcode value.  The table is constexpr so the handler
+  dispatch table in op_handler.cpp can be generated from it at compile time.
+*/
+inline constexpr OpCode opCodes[256] = {
     {0x00, "NOP", NOP, 1, 4},
     {0x01, "LD BC,nn", LD, 3, 12, ATypeIR, {BC, NN}},
     {0x02, "LD (BC),A", LD, 1, 8, ATypeRA, {BC, A}},
@@ -222,7 +228,7 @@ OpCode opCodes[] = {
     {0xCB, "CB op", CB, 2, 8, ATypeJ},
     {0xCC, "CALL Z,nn", CALL, 3, 12, ATypeJ_Z, {NN}},
     {0xCD, "CALL nn", CALL, 3, 24, ATypeJ, {NN}},
-    {0xCE, "ADC n", ADC, 2, 8, ATypeNA, {N}},
+    {0xCE, "ADC n", ADC, 2, 8, ATypeNA, {A, N}},
     {0xCF, "RST 0x08", RST, 1, 16, ATypeNA, {x08}},
 
     {0xD0, "RET NC", RET, 1, 8, ATypeJ_NC},
@@ -244,9 +250,9 @@ OpCode opCodes[] = {
 
     {0xE0, "LDH (n),A", LDH, 2, 12, ATypeRA, {N, A}},
     {0xE1, "POP HL", POP, 1, 12, ATypeNA, {HL}},
-    {0xE3, "LDH (C),A", LDH, 1, 8, ATypeRA, {C, A}},
+    {0xE2, "LDH (C),A", LDH, 1, 8, ATypeRA, {C, A}},
+    {0xE3, "", X, 1},
     {0xE4, "", X, 1},
-    {0xE5, "", X, 1},
     {0xE5, "PUSH HL", PUSH, 1, 16, ATypeNA, {HL}},
     {0xE6, "AND n", AND, 2, 8, ATypeNA, {N}},
     {0xE7, "RST 0x20", RST, 1, 16, ATypeNA, {x20}},
@@ -277,4 +283,16 @@ OpCode opCodes[] = {
     {0xFF, "RST 0x38", RST, 1, 16, ATypeNA, {x38}},
 };
 
+constexpr bool opCodesInOrder() {
+    for (int i=0; i<256; i++) {
+        if (opCodes[i].value != i) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static_assert(opCodesInOrder(), "opCodes entries must be in opcode order");
+
 }
@@ -0,0 +1,249 @@
+#include "pacer.h"
+#include "ppu.h"
+#include "cpu.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace dsemu::pacer {
+
+typedef std::chrono::steady_clock Clock;
+
+const double PERIOD_NS = 1e9 * ppu::TICKS_PER_FRAME / ppu::HZ;
+
+//sleep until this close to the deadline, then spin.  Sleeps on Linux
+//overshoot by well under this.
+const auto SPIN = std::chrono::microseconds(1000);
+
+//this far behind (a pause, a debugger) start counting again instead of catching up.
+const auto RESYNC = std::chrono::milliseconds(100);
+
+static std::atomic<Mode> mode{ModeFixed};
+static std::atomic<double> multiplier{1.0};
+static std::atomic<bool> rebase{true};
+
+static AUDIO_QUEUE_HANDLER audioQueued = nullptr;
+static uint32_t audioTarget = 0;
+
+//deadline of frame n is base + n periods, so no rounding accumulates.
+static Clock::time_point base;
+static Clock::time_point deadline;
+static uint64_t frameNumber;
+
+static std::mutex statsMutex;
+static Clock::time_point lastFrame;
+static uint64_t statFrames;
+static double statSum, statSumSq, statWorst;
+static uint64_t statLate;
+
+static Clock::time_point lastReport = Clock::now();
+
+static std::mutex mutex;
+static std::condition_variable signal;
+static uint64_t framesDone = 0;
+static std::atomic<bool> paused{false};
+
+void setMode(Mode m) {
+    mode = m;
+    rebase = true;
+}
+
+Mode getMode() {
+    return mode;
+}
+
+void setMultiplier(double m) {
+    multiplier = m;
+    rebase = true;
+}
+
+double getMultiplier() {
+    return multiplier;
+}
+
+bool parse(const string &speed) {
+    if (speed == "unthrottled") {
+        setMode(ModeUnthrottled);
+        return true;
+    }
+
+    if (speed == "audio") {
+        setMode(ModeAudio);
+        return true;
+    }
+
+    char *end;
+    double m = strtod(speed.c_str(), &end);
+
+    if (*end || m <= 0) {
+        return false;
+    }
+
+    setMode(ModeFixed);
+    setMultiplier(m);
+    return true;
+}
+
+void setAudioQueue(AUDIO_QUEUE_HANDLER queued, uint32_t target) {
+    audioQueued = queued;
+    audioTarget = target;
+}
+
+static void waitUntil(Clock::time_point t) {
+    Clock::time_point now = Clock::now();
+
+    if (t - now > SPIN) {
+        std::this_thread::sleep_for(t - now - SPIN);
+    }
+
+    while (Clock::now() < t) {
+        std::this_thread::yield();
+    }
+}
+
+//the audio device drains the queue in real time, so holding it at the
+//target runs the emulator at the device's clock.
+static void waitForAudio() {
+    Clock::time_point giveUp = Clock::now() + RESYNC;
+
+    while (audioQueued() > audioTarget && Clock::now() < giveUp) {
+        std::this_thread::sleep_for(std::chrono::microseconds(250));
+    }
+}
+
+static void waitForDeadline(double speed) {
+    Clock::time_point now = Clock::now();
+
+    if (rebase.exchange(false) || now > deadline + RESYNC) {
+        base = now;
+        frameNumber = 0;
+    }
+
+    frameNumber++;
+    deadline = base + std::chrono::nanoseconds((int64_t)(frameNumber * PERIOD_NS / speed));
+
+    waitUntil(deadline);
+}
+
+static void record(Clock::time_point now, double targetMs) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+
+    if (lastFrame != Clock::time_point()) {
+        double ms = std::chrono::duration<double, std::milli>(now - lastFrame).count();
+
+        statFrames++;
+        statSum += ms;
+        statSumSq += ms * ms;
+
+        if (targetMs > 0) {
+            statWorst = std::max(statWorst, std::fabs(ms - targetMs));
+            statLate += now - deadline > std::chrono::milliseconds(1);
+        }
+    }
+
+    lastFrame = now;
+}
+
+Stats takeStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    Stats s;
+
+    s.frames = statFrames;
+    s.meanMs = statFrames ? statSum / statFrames : 0;
+    s.jitterMs = statFrames ? std::sqrt(std::max(0.0, statSumSq / statFrames - s.meanMs * s.meanMs)) : 0;
+    s.worstMs = statWorst;
+    s.late = statLate;
+
+    statFrames = 0;
+    statSum = statSumSq = statWorst = 0;
+    statLate = 0;
+
+    return s;
+}
+
+static void report(Machine &m, Clock::time_point now) {
+    static uint64_t lastTicks = 0;
+    static uint64_t lastSkipped = 0;
+
+    uint64_t ticks = cpu::getTickCount(m);
+    uint64_t skipped = m.cpu.stats.haltedCycles + m.cpu.stats.idleCycles;
+    Stats s = takeStats();
+
+    if (ticks > lastTicks) {
+        cout << "FPS: " << s.frames << " - Idle: " << (skipped - lastSkipped) * 100 / (ticks - lastTicks) << "%"
+             << std::fixed << std::setprecision(2)
+             << " - Frame: " << s.meanMs << "ms +/- " << s.jitterMs << ", worst " << s.worstMs << ", late " << s.late
+             << std::defaultfloat << endl;
+    }
+
+    lastTicks = ticks;
+    lastSkipped = skipped;
+    lastReport = now;
+}
+
+void frame(Machine &m) {
+    Mode current = mode;
+    double targetMs = 0;
+
+    if (current == ModeAudio && audioQueued) {
+        waitForAudio();
+    } else if (current != ModeUnthrottled) {
+        double speed = current == ModeFixed ? (double)multiplier : 1;
+
+        waitForDeadline(speed);
+        targetMs = PERIOD_NS / speed / 1e6;
+    }
+
+    Clock::time_point now = Clock::now();
+    record(now, targetMs);
+
+    if (now - lastReport >= std::chrono::seconds(1)) {
+        report(m, now);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        framesDone++;
+    }
+
+    signal.notify_all();
+}
+
+void setPaused(bool p) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        paused = p;
+    }
+
+    signal.notify_all();
+}
+
+bool isPaused() {
+    return paused;
+}
+
+void waitWhilePaused() {
+    if (!paused) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    signal.wait(lock, [] { return !paused; });
+
+    rebase = true;
+}
+
+void waitFrame(int timeoutMs) {
+    static uint64_t seen = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    signal.wait_for(lock, std::chrono::milliseconds(timeoutMs), [] { return framesDone != seen; });
+
+    seen = framesDone;
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+/*
+  Frame pacer.
+
+  The only place emulation is slowed down.  A frontend sets frame() as the
+  Machine's ppu.onFrame, so it runs at every VBlank and waits until that
+  frame is due, against deadlines on steady_clock so rounding never adds up:
+  it sleeps until shortly before the deadline and spins the rest, which gets
+  well under a millisecond of error.
+  A real DMG frame is 17556 cycles of a 1 MiHz clock, about 59.73 Hz.
+
+  It also owns pausing and lets the UI thread sleep until a frame is ready.
+*/
+
+namespace dsemu::pacer {
+
+enum Mode {
+    ModeFixed,          //real time times the multiplier, 2 and 4 for turbo
+    ModeUnthrottled,    //as fast as it goes
+    ModeAudio           //hold the audio queue at its target, real time if there is none
+};
+
+void setMode(Mode m);
+Mode getMode();
+
+//speed in ModeFixed, 1 is real time.
+void setMultiplier(double m);
+double getMultiplier();
+
+//parses "unthrottled", "audio" or a multiplier like "1", "2", "0.5".
+bool parse(const string &speed);
+
+typedef uint32_t (*AUDIO_QUEUE_HANDLER)();
+
+//samples waiting to be played and how many to keep queued, for ModeAudio.
+void setAudioQueue(AUDIO_QUEUE_HANDLER queued, uint32_t target);
+
+//called by the PPU at VBlank, returns when the next frame may start.
+void frame(Machine &m);
+
+struct Stats {
+    uint64_t frames;
+    double meanMs;      //average time between frames
+    double jitterMs;    //standard deviation of it
+    double worstMs;     //furthest any frame was from the target period
+    uint64_t late;      //frames that started more than 1ms past their deadline
+};
+
+//stats since the last call.
+Stats takeStats();
+
+void setPaused(bool p);
+bool isPaused();
+
+//emulator thread, blocks while paused.
+void waitWhilePaused();
+
+//UI thread, returns when a frame has finished or after timeoutMs.
+void waitFrame(int timeoutMs);
+
+}
@@ -4,212 +4,373 @@
 #include "io.h"
 #include "ui.h"
 #include "bus.h"
+#include "scheduler.h"
+#include "compositor.h"
+#include "input.h"
 
 #include <chrono>
 #include <thread>
 #include <unistd.h>
 #include <cstring>
-#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
 
 namespace dsemu::ppu {
 
+//m.ppu.spareFrame holds the index of the spare buffer, with FRAME_FRESH set
+//until the UI takes it.
+const int FRAME_FRESH = 4;
 
-byte lcdControl;
-
-byte lcdStats = 0;
+static void publishFrame(Machine &m) {
+    State &p = m.ppu;
+    p.backFrame = p.spareFrame.exchange(p.backFrame | FRAME_FRESH, std::memory_order_acq_rel) & 3;
+    p.videoBuffer = m.frameBuffers[p.backFrame];
+}
 
-ScrollInfo scrollInfo;
-int currentFrame = 0;
-byte currentLine = 0;
-byte oamRAM[160];
+const uint32_t *takeFrame(Machine &m) {
+    State &p = m.ppu;
 
-unsigned long *videoBuffer;
+    if (!(p.spareFrame.load(std::memory_order_acquire) & FRAME_FRESH)) {
+        return nullptr;
+    }
 
-void init() {
-    currentFrame = 0;
-    currentLine = 0;
-    scrollInfo.x = 0;
-    scrollInfo.y = 0;
-    memset(oamRAM, 0, sizeof(oamRAM));
+    p.frontFrame = p.spareFrame.exchange(p.frontFrame, std::memory_order_acq_rel) & 3;
 
-    videoBuffer = new unsigned long[256 * 256];
-    memset(videoBuffer, 0, 256 * 256 * sizeof(unsigned long));
+    return m.frameBuffers[p.frontFrame];
+}
 
-    cout << "VID BUFF: " << Int64((uint64_t)videoBuffer) << endl;
+void setTarget(Machine &m, void *buffer, Format format) {
+    State &p = m.ppu;
+    p.target = buffer;
+    p.indexBuffer = buffer && format == FormatIndex ? (byte *)buffer : nullptr;
+    p.videoBuffer = buffer && format == FormatARGB ? (uint32_t *)buffer : m.frameBuffers[p.backFrame];
 }
 
-void drawFrame() {
+void setRenderInterval(Machine &m, int n) {
+    m.ppu.renderInterval = n;
+    m.ppu.renderFrame = n > 0 && (m.ppu.currentFrame % n) == 0;
+}
 
-    if (!cpu::haltWaitingForInterrupt) {
-        /*
-        cout << "SPRITES: " << endl;
-        for (int i=0; i<160; i += 4) {
-            OAMEntry *entry = (OAMEntry *)&oamRAM[i];
-            
-            cout << Byte(entry->x) << "," << Byte(entry->y) << "-" << Byte(entry->tile) << " ";
+int getRenderInterval(const Machine &m) {
+    return m.ppu.renderInterval;
+}
 
-            if ((i % 40) == 0) {
-                cout << endl;
-            }
-        }
+void writeVRAM(Machine &m, ushort address, byte b) {
+    sync(m);
 
-        cout << endl;
+    byte &old = m.ram[address];
 
+    if (old != b) {
+        old = b;
 
-        cout  << endl << "LCD Status: " << endl
-            << "\tbgDisplay: " << Byte(bgDisplay()) << endl
-            << "\tspriteDisplay: " << Byte(spriteDisplay()) << endl
-            << "\tspriteSize8x16: " << Byte(spriteSize8x16()) << endl
-            << "\tbgMapStart: " << Short(bgMapStart()) << endl
-            << "\tbgTileStart: " << Short(bgTileStart()) << endl
-            << "\twindowDisplay: " << Byte(windowDisplay()) << endl
-            << "\twindowMapSelect: " << Short(windowMapSelect()) << endl
-            << "\tlcdOn: " << Byte(lcdOn()) << endl << endl;
-    */
-        //if (!DEBUG) return;
+        if (address < 0x9800) {
+            m.ppu.tileDirty[(address - 0x8000) >> 4] = true;
+        }
     }
-    
-}
-
-byte getCurrentLine() {
-    return currentLine;
 }
-byte readOAM(ushort address) {
 
+//first byte of each row holds bit 0 of the colours, the second bit 1.
+void decodeTile(Machine &m, int tile) {
+    const byte *data = m.ram + 0x8000 + (tile * 16);
 
-    //cout << "READ DUMPING OAM RAM: " << Short(address) << " - " << Byte(memory::ram[address]) << " - " << endl;
+    for (int y=0; y<8; y++) {
+        byte lo = data[y * 2];
+        byte hi = data[y * 2 + 1];
 
-    for (int i=0; i<160; i++) {
-        //if ((i % 32) == 0) cout << endl;
-        //cout << " " << Byte(oamRAM[i]);
+        for (int x=0; x<8; x++) {
+            int bit = 7 - x;
+            m.tileCache[tile][y][x] = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+        }
     }
 
-    //cout << endl;
+    m.ppu.tileDirty[tile] = false;
+}
 
-    //sleep(2);
+template<class R>
+void onEvent(Machine &m, uint64_t when);
+
+void init(Machine &m) {
+    State &p = m.ppu;
+    p.currentFrame = 0;
+    p.currentLine = 0;
+    p.scrollInfo.x = 0;
+    p.scrollInfo.y = 0;
+    memset(m.oamRAM, 0, sizeof(m.oamRAM));
+    memset(p.tileDirty, 1, sizeof(p.tileDirty));
+
+    memset(m.frameBuffers, 0, sizeof(m.frameBuffers));
+    p.backFrame = 0;
+    p.spareFrame = 1;
+    p.frontFrame = 2;
+    setTarget(m, p.target, p.indexBuffer ? FormatIndex : FormatARGB);
+    p.windowLine = 0;
+    setRenderInterval(m, p.renderInterval);
+
+    p.mode = ModeOAM;
+    p.lcdStats = (p.lcdStats & ~3) | p.mode;
+    scheduler::setHandler(m, scheduler::EventPPU, onEvent<Renderer>);
+    scheduler::add(m, scheduler::EventPPU, OAM_TICKS);
+}
 
+byte getCurrentLine(Machine &m) {
+    return m.ppu.currentLine;
+}
 
-    return oamRAM[address];
+byte readOAM(Machine &m, ushort address) {
+    return m.oamRAM[address];
 }
 
-void writeOAM(ushort address, byte b) {
-    oamRAM[address] = b;
+void writeOAM(Machine &m, ushort address, byte b) {
+    sync(m);
+    m.oamRAM[address] = b;
 }
 
-long targetFrameTime = 1000 / 60;
-long start = SDL_GetTicks();
-int count = 0;
-long prev = SDL_GetTicks();
-static unsigned long colors[4] = {0xFFFFFF, 0xC0C0C0, 0x808080, 0x000000};
+/*
+  OAM search: the first 10 sprites in OAM order that overlap the line, then
+  ordered by drawing priority.  On the DMG the sprite with the lower X is on
+  top, and on equal X the one earlier in OAM.
+*/
+void evaluateSprites(Machine &m, int lineNum) {
+    int height = spriteSize8x16(m) ? 16 : 8;
+    OAMEntry **lineSprites = m.ppu.lineSprites;
+    int &lineSpriteCount = m.ppu.lineSpriteCount;
+    lineSpriteCount = 0;
+
+    for (int i=0; i<40 && lineSpriteCount < MAX_LINE_SPRITES; i++) {
+        OAMEntry *entry = (OAMEntry *)&m.oamRAM[i * 4];
+        int top = entry->y - 16;
+
+        if (lineNum >= top && lineNum < top + height) {
+            lineSprites[lineSpriteCount++] = entry;
+        }
+    }
 
-int normScroll = 3;
+    //insertion sort keeps OAM order for equal X.
+    for (int i=1; i<lineSpriteCount; i++) {
+        OAMEntry *entry = lineSprites[i];
+        int j = i - 1;
 
+        while (j >= 0 && lineSprites[j]->x > entry->x) {
+            lineSprites[j + 1] = lineSprites[j];
+            j--;
+        }
 
-vector<OAMEntry *> getSpritesOnLine(int lineNum) {
+        lineSprites[j + 1] = entry;
+    }
+}
 
-    vector<OAMEntry *> entries;
+void drawBackground(Machine &m, int lineNum, byte *bg) {
+    int mapy = (lineNum + getYScroll(m)) & 0xFF;
+    int row = mapy & 7;
+    int scrollX = getXScroll(m);
+    const byte *map = m.ram + bgMapStart(m) + ((mapy / 8) * 32);
 
-    for (int i=0; i<160; i += 4) {
-        OAMEntry *entry = (OAMEntry *)&oamRAM[i];
-        
-        if (entry->y >= lineNum + 8 && entry->y < lineNum + 16) {
-            entries.push_back(entry);
-        }
+    //21 tiles cover the 160 pixels whatever the fine X scroll is.
+    byte pixels[21 * 8];
+
+    for (int i=0; i<21; i++) {
+        byte n = map[((scrollX / 8) + i) & 31];
+        memcpy(pixels + (i * 8), tileRow(m, bgTileIndex(m, n), row), 8);
     }
 
-    return entries;
+    memcpy(bg, pixels + (scrollX & 7), XRES);
 }
 
-OAMEntry *getSpriteOnX(vector<OAMEntry *> &sprites, int x) {
-    for (auto entry : sprites) {
-        if (entry->x >= x && entry->x < x + 8) {
-            return entry;
-        }
-    }
+//the window has its own line counter, it only advances on lines it is drawn.
+void drawWindow(Machine &m, int lineNum, byte *bg) {
+    int &windowLine = m.ppu.windowLine;
+    int wy = m.ram[0xFF4A];
+    int start = m.ram[0xFF4B] - 7;
 
-    return nullptr;
-}
+    if (!windowDisplay(m) || lineNum < wy || start >= XRES) {
+        return;
+    }
 
-void drawLine(int lineNum) {
-    int mapy = (lineNum + getYScroll()) % 256;
-    byte tileY = ((lineNum) % 8) * 2;
+    int row = windowLine & 7;
+    const byte *map = m.ram + windowMapSelect(m) + ((windowLine / 8) * 32);
 
-    auto sprites = getSpritesOnLine(lineNum);
+    for (int x=std::max(start, 0); x<XRES; x++) {
+        int wx = x - start;
+        bg[x] = tileRow(m, bgTileIndex(m, map[wx / 8]), row)[wx & 7];
+    }
 
-    for (int x=0; x<XRES; x += 1) {
-        auto sprite = getSpriteOnX(sprites, x);
+    windowLine++;
+}
 
-        int mapx = (x + getXScroll()) % 256;
+void drawSprites(Machine &m, int lineNum, compositor::Line &line) {
+    bool tall = spriteSize8x16(m);
 
-        ushort bgTileNum = bus::read(ppu::bgMapStart() + (mapx/8) + ((mapy/8) * 32));
+    //lowest priority first so the sprites on top overwrite it.
+    for (int i=m.ppu.lineSpriteCount - 1; i>=0; i--) {
+        OAMEntry *sprite = m.ppu.lineSprites[i];
+        int row = lineNum + 16 - sprite->y;
+        byte tile = sprite->tile;
 
-        if (ppu::bgTileStart() == 0x8800) {
-            bgTileNum += 128;
+        if (sprite->flags & 0x40) {
+            row = (tall ? 15 : 7) - row;
         }
 
-        if (sprite != nullptr) {
-            bgTileNum = sprite->tile;
+        if (tall) {
+            tile = (tile & 0xFE) | (row >> 3);
+            row &= 7;
         }
 
-        byte b1 = bus::read(ppu::bgTileStart() + (bgTileNum * 16) + tileY);
-        byte b2 = bus::read(ppu::bgTileStart() + (bgTileNum * 16) + 1 + tileY);
+        const byte *pixels = tileRow(m, tile, row);
 
-        int bit = 7 - (x % 8);
-        byte hi = !!(b1 & (1 << bit)) << 1;
-        byte lo = !!(b2 & (1 << bit));
-        byte color = hi|lo;
-        unsigned long c = colors[color];
+        for (int px=0; px<8; px++) {
+            int x = sprite->x - 8 + px;
 
-        videoBuffer[x + (lineNum * XRES)] = c;
+            if (x < 0 || x >= XRES) {
+                continue;
+            }
+
+            byte c = pixels[(sprite->flags & 0x20) ? 7 - px : px];
+
+            if (c) {
+                line.obj[x] = c;
+                line.objAttr[x] = sprite->flags;
+                line.objMask[x >> 6] |= 1ULL << (x & 63);
+            }
+        }
     }
 }
 
-void tick() {
-    int f = cpu::getTickCount() % (TICKS_PER_FRAME);
-    int l = f / 114;
+void drawLine(Machine &m, int lineNum) {
+    compositor::Line line;
+
+    if (bgDisplay(m)) {
+        drawBackground(m, lineNum, line.bg);
+        drawWindow(m, lineNum, line.bg);
+    } else {
+        memset(line.bg, 0, sizeof(line.bg));
+    }
+
+    memset(line.objMask, 0, sizeof(line.objMask));
 
-    if (l != currentLine && l < 144) {
-        if (DEBUG && !cpu::haltWaitingForInterrupt) cout << "PPU:> NEW LINE: " << l << " FRAME: " << currentFrame << endl;
+    //the compositor does not look at the sprite layers where the mask is clear.
+    if (spriteDisplay(m) && m.ppu.lineSpriteCount) {
+        memset(line.obj, 0, sizeof(line.obj));
+        memset(line.objAttr, 0, sizeof(line.objAttr));
+        drawSprites(m, lineNum, line);
+    }
 
-        drawLine(currentLine);
+    if (m.ppu.indexBuffer) {
+        compositor::composeIndex(line, m.ram[0xFF47], m.ram[0xFF48], m.ram[0xFF49], m.ppu.indexBuffer + (lineNum * XRES));
+    } else {
+        compositor::compose(line, m.ram[0xFF47], m.ram[0xFF48], m.ram[0xFF49], m.ppu.videoBuffer + (lineNum * XRES));
     }
+}
 
-    if (lcdStats & 0x40 && bus::read(0xFF45) == l) {
-        cpu::handleInterrupt(2, true, false);
+void ScanlineRenderer::endTransfer(Machine &m, int lineNum) {
+    if (m.ppu.renderFrame) {
+        drawLine(m, lineNum);
     }
-    
-    if (l != currentLine && l == 144) {
-        long end = SDL_GetTicks();
-		long frameTime = end - prev;
+}
 
-		if (frameTime < targetFrameTime) 
-		{
-			SDL_Delay(targetFrameTime - frameTime);
-		}
+void checkLYC(Machine &m) {
+    State &p = m.ppu;
+    bool match = m.ram[0xFF45] == p.currentLine;
+    bool was = getBit(p.lcdStats, 2);
 
-		if (end - start >= 1000) {
-			if (!cpu::haltWaitingForInterrupt) cout << "FPS: " << count << endl;
-			count = 0;
-			start = end;
-		}
+    setBit(p.lcdStats, 2, match);
+
+    if (match && !was && (p.lcdStats & 0x40)) {
+        cpu::handleInterrupt(m, cpu::ILCDStat, true, false);
+    }
+}
 
-		count++;
+//STAT bits 3, 4 and 5 request an interrupt on entering HBlank, VBlank and OAM.
+void setMode(Machine &m, Mode mode) {
+    State &p = m.ppu;
+    p.mode = mode;
+    p.lcdStats = (p.lcdStats & ~3) | mode;
 
-        currentFrame++;
-        drawFrame();
-        if (!cpu::haltWaitingForInterrupt) cout << endl << "PPU:> NEW FRAME: " << currentFrame << endl << endl;
+    if (mode != ModeTransfer && getBit(p.lcdStats, 3 + mode)) {
+        cpu::handleInterrupt(m, cpu::ILCDStat, true, false);
+    }
+}
 
-        cpu::handleInterrupt(cpu::IVBlank, true, false);
+void vblank(Machine &m, uint64_t when) {
+    State &p = m.ppu;
 
-        prev = SDL_GetTicks();
+    if (p.renderFrame && !p.target) {
+        publishFrame(m);
     }
 
-    currentLine = l;
+    p.currentFrame++;
+    p.renderFrame = p.renderInterval > 0 && (p.currentFrame % p.renderInterval) == 0;
+    if (DEBUG && !m.cpu.haltWaitingForInterrupt) cout << endl << "PPU:> NEW FRAME: " << p.currentFrame << endl << endl;
 
+    cpu::handleInterrupt(m, cpu::IVBlank, true, false);
+
+    if (p.onFrame) {
+        p.onFrame(m);
+    }
 
+    input::frameStart(m, when);
 }
 
+void newLine(Machine &m) {
+    State &p = m.ppu;
+    p.currentLine++;
+
+    if (p.currentLine == LINES_PER_FRAME) {
+        p.currentLine = 0;
+        p.windowLine = 0;
+    }
+
+    if (DEBUG && !m.cpu.haltWaitingForInterrupt) cout << "PPU:> NEW LINE: " << (int)p.currentLine << " FRAME: " << p.currentFrame << endl;
+
+    checkLYC(m);
 }
 
+/*
+  Each line is OAM search -> pixel transfer -> HBlank, then lines 144-153 are
+  VBlank.  Every mode change is one scheduler event.  Pixel transfer takes
+  as long as the renderer says, HBlank gets the rest of the line.
+*/
+template<class R>
+void onEvent(Machine &m, uint64_t when) {
+    State &p = m.ppu;
+
+    switch(p.mode) {
+        case ModeOAM:
+            evaluateSprites(m, p.currentLine);
+            setMode(m, ModeTransfer);
+            R::beginTransfer(m, p.currentLine, when);
+            scheduler::add(m, scheduler::EventPPU, when + R::transferTicks(m));
+            break;
+
+        case ModeTransfer:
+            R::endTransfer(m, p.currentLine);
+            setMode(m, ModeHBlank);
+            scheduler::add(m, scheduler::EventPPU, when + TICKS_PER_LINE - OAM_TICKS - R::transferTicks(m));
+            break;
+
+        case ModeHBlank:
+            newLine(m);
+
+            if (p.currentLine == VBLANK_LINE) {
+                setMode(m, ModeVBlank);
+                vblank(m, when);
+                scheduler::add(m, scheduler::EventPPU, when + TICKS_PER_LINE);
+            } else {
+                setMode(m, ModeOAM);
+                scheduler::add(m, scheduler::EventPPU, when + OAM_TICKS);
+            }
+            break;
 
+        case ModeVBlank:
+            newLine(m);
 
+            if (p.currentLine == 0) {
+                setMode(m, ModeOAM);
+                scheduler::add(m, scheduler::EventPPU, when + OAM_TICKS);
+            } else {
+                scheduler::add(m, scheduler::EventPPU, when + TICKS_PER_LINE);
+            }
+            break;
+    }
+}
+
+}
@@ -1,21 +1,41 @@
 #pragma once
 
 #include "common.h"
+#include "machine.h"
 
+#include <type_traits>
+
+/*
+  Build with -DDSEMU_PPU_FIFO=1 for the pixel FIFO renderer instead of the
+  scanline one, see Renderer below.
+*/
+#ifndef DSEMU_PPU_FIFO
+#define DSEMU_PPU_FIFO 0
+#endif
 
 namespace dsemu::ppu {
 
-struct ScrollInfo {
-    byte x;
-    byte y;
-};
+/*
+  Frames are 160x144 ARGB8888 and triple buffered.  The PPU draws into
+  m.ppu.videoBuffer and at VBlank swaps it with the spare buffer in one atomic
+  exchange, takeFrame() swaps the spare with the one the UI shows.  Neither
+  side ever waits for the other and the UI always gets the newest complete
+  frame.
+*/
 
-extern unsigned long *videoBuffer;
+//newest complete frame, or null if there is none since the last call.  It
+//stays valid until the next call.
+const uint32_t *takeFrame(Machine &m);
 
-extern byte lcdControl;
-extern byte lcdStats;
-extern ScrollInfo scrollInfo;
-extern int currentFrame;
+/*
+  Drawing into the caller's memory.  With a target set the renderers write
+  each line straight into buffer, XRES x YRES pixels in the given format,
+  and nothing is swapped at VBlank, so takeFrame() has nothing new.  The
+  buffer holds a whole frame whenever the machine stops at a frame boundary
+  (runFrames()).  Null goes back to the triple buffers.  May be called
+  before init(), which keeps it.
+*/
+void setTarget(Machine &m, void *buffer, Format format);
 
 const int HZ = 1048576;
 const int LINES_PER_FRAME = 154;
@@ -25,29 +45,21 @@ const int OAM_TICKS = 20;
 const int PIXEL_TICKS = 43;
 const int VBLANK_LINE = 144;
 
-const int YRES = 144;
-const int XRES = 160;
+void init(Machine &m);
 
-void tick();
-void init();
+byte getCurrentLine(Machine &m);
 
-byte getCurrentLine();
+//recompute the LY=LYC flag, call when LY, LYC or STAT change.
+void checkLYC(Machine &m);
 
-struct OAMEntry {
-    byte y;
-    byte x;
-    byte tile;
-    byte flags;
-};
-
-inline bool bgDisplay() { return getBit(lcdControl, 0); }
-inline bool spriteDisplay() { return getBit(lcdControl, 1); }
-inline bool spriteSize8x16() { return getBit(lcdControl, 2); }
-inline ushort bgMapStart() { return getBit(lcdControl, 3) ? 0x9C00 : 0x9800; }
-inline ushort bgTileStart() { return getBit(lcdControl, 4) ? 0x8000 : 0x8800; }
-inline bool windowDisplay() { return getBit(lcdControl, 5); }
-inline ushort windowMapSelect() { return getBit(lcdControl, 6) ? 0x9C00 : 0x9800; }
-inline bool lcdOn() { return getBit(lcdControl, 7); }
+inline bool bgDisplay(Machine &m) { return getBit(m.ppu.lcdControl, 0); }
+inline bool spriteDisplay(Machine &m) { return getBit(m.ppu.lcdControl, 1); }
+inline bool spriteSize8x16(Machine &m) { return getBit(m.ppu.lcdControl, 2); }
+inline ushort bgMapStart(Machine &m) { return getBit(m.ppu.lcdControl, 3) ? 0x9C00 : 0x9800; }
+inline ushort bgTileStart(Machine &m) { return getBit(m.ppu.lcdControl, 4) ? 0x8000 : 0x8800; }
+inline bool windowDisplay(Machine &m) { return getBit(m.ppu.lcdControl, 5); }
+inline ushort windowMapSelect(Machine &m) { return getBit(m.ppu.lcdControl, 6) ? 0x9C00 : 0x9800; }
+inline bool lcdOn(Machine &m) { return getBit(m.ppu.lcdControl, 7); }
 
 /*
 OAM Entry:
@@ -60,16 +72,82 @@ OAM Entry:
     Palette bits
 */
 
-extern byte oamRAM[160];
+/*
+  Decoded tile cache.
+
+  m.tileCache keeps the 384 tiles at 8000-97FF as one colour index (0-3) per
+  pixel, so a scanline is built by copying 8 pixel rows.  VRAM writes only
+  mark a tile dirty, it is decoded again the next time it is drawn.
+*/
+void writeVRAM(Machine &m, ushort address, byte b);
+
+void decodeTile(Machine &m, int tile);
+
+inline const byte *tileRow(Machine &m, int tile, int row) {
+    if (m.ppu.tileDirty[tile]) {
+        decodeTile(m, tile);
+    }
+
+    return m.tileCache[tile][row];
+}
+
+//cache index of a BG/window map entry under the current addressing mode.
+inline int bgTileIndex(Machine &m, byte n) {
+    return bgTileStart(m) == 0x8000 ? n : 256 + (int8_t)n;
+}
+
+byte readOAM(Machine &m, ushort address);
+void writeOAM(Machine &m, ushort address, byte b);
+
+inline byte getXScroll(Machine &m) { return m.ppu.scrollInfo.x; }
+inline byte getYScroll(Machine &m) { return m.ppu.scrollInfo.y; }
+
+inline void setXScroll(Machine &m, byte b) { m.ppu.scrollInfo.x = b; }
+inline void setYScroll(Machine &m, byte b) { m.ppu.scrollInfo.y = b; }
+
+/*
+  Render skip.  Only every Nth frame is drawn into videoBuffer and 0 draws
+  none.  Mode timing, STAT interrupts and LY are the same either way, a
+  skipped frame just leaves the buffer as it was.
+*/
+void setRenderInterval(Machine &m, int n);
+int getRenderInterval(const Machine &m);
+
+/*
+  Renderers.
+
+  The mode state machine is the same for both, it asks the renderer how long
+  pixel transfer takes and lets it draw.  Both read the same registers, VRAM
+  and OAM, they only differ in when they look at them.
+
+  ScanlineRenderer draws the whole line at the end of pixel transfer with the
+  registers as they are then, mode 3 is always 43 cycles.
+
+  FifoRenderer steps the background/sprite fetcher and the pixel FIFO one dot
+  at a time, so mode 3 gets longer with fine scroll, the window and sprites,
+  and register writes land on the pixel they happen at.  It runs lazily:
+  sync() catches it up to the CPU before anything it reads is written.
+*/
+struct ScanlineRenderer {
+    static void beginTransfer(Machine &m, int lineNum, uint64_t when) {}
+    static int transferTicks(Machine &m) { return PIXEL_TICKS; }
+    static void endTransfer(Machine &m, int lineNum);
+    static void sync(Machine &m) {}
+};
 
-byte readOAM(ushort address);
-void writeOAM(ushort address, byte b);
+struct FifoRenderer {
+    static void beginTransfer(Machine &m, int lineNum, uint64_t when);
+    static int transferTicks(Machine &m);
+    static void endTransfer(Machine &m, int lineNum);
+    static void sync(Machine &m);
+};
 
-inline byte getXScroll() { return scrollInfo.x; }
-inline byte getYScroll() { return scrollInfo.y; }
+using Renderer = std::conditional_t<DSEMU_PPU_FIFO, FifoRenderer, ScanlineRenderer>;
 
-inline void setXScroll(byte b) { scrollInfo.x = b; }
-inline void setYScroll(byte b) { scrollInfo.y = b; }
+//call before changing anything the renderer reads, compiles to nothing for the scanline renderer.
+inline void sync(Machine &m) {
+    Renderer::sync(m);
+}
 
 }
 
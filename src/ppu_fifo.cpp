@@ -0,0 +1,265 @@
+#include "ppu.h"
+#include "cpu.h"
+#include "memory.h"
+#include "compositor.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace dsemu::ppu {
+
+/*
+  Pixel FIFO renderer.
+
+  Every dot the FIFO shifts one pixel out to the LCD and the fetcher works
+  on the next tile row: 2 dots each for the tile number, the low and the
+  high byte, then it waits until the FIFO is empty to push the 8 pixels.
+  The first fetch of a line is thrown away, which with 160 pixels gives the
+  172 dot minimum.  On top of that:
+
+  - the first SCX & 7 pixels are shifted out and dropped,
+  - when the window starts the FIFO is cleared and the fetcher restarts on
+    the window map,
+  - when a sprite starts at the current pixel the output stops while its
+    row is fetched and merged into the sprite FIFO.
+
+  Every register, VRAM and OAM read happens on the dot it would on hardware,
+  so writes made during mode 3 take effect from that pixel on.
+*/
+
+const int MAX_TRANSFER_DOTS = (TICKS_PER_LINE - OAM_TICKS - 1) * 4;
+
+static ushort tileAddress(Machine &m, byte n, int row) {
+    ushort base = bgTileStart(m) == 0x8000 ? 0x8000 + (n * 16) : 0x9000 + ((int8_t)n * 16);
+
+    return base + (row * 2);
+}
+
+static void fetchTileNumber(Machine &m, Fifo &f) {
+    if (f.window) {
+        ushort map = windowMapSelect(m) + ((m.ppu.windowLine / 8) * 32);
+        f.tile = m.ram[map + (f.fetchX & 31)];
+    } else {
+        int mapy = (f.line + getYScroll(m)) & 0xFF;
+        ushort map = bgMapStart(m) + ((mapy / 8) * 32);
+        f.tile = m.ram[map + (((getXScroll(m) / 8) + f.fetchX) & 31)];
+    }
+}
+
+static int fetchRow(Machine &m, const Fifo &f) {
+    return f.window ? (m.ppu.windowLine & 7) : ((f.line + getYScroll(m)) & 7);
+}
+
+static void stepFetcher(Machine &m, Fifo &f) {
+    if (f.fetchDot < 6) {
+        f.fetchDot++;
+
+        switch (f.fetchDot) {
+            case 2: fetchTileNumber(m, f); break;
+            case 4: f.lo = m.ram[tileAddress(m, f.tile, fetchRow(m, f))]; break;
+            case 6: f.hi = m.ram[tileAddress(m, f.tile, fetchRow(m, f)) + 1]; break;
+        }
+    }
+
+    if (f.fetchDot < 6 || f.bgCount) {
+        return;
+    }
+
+    f.fetchDot = 0;
+
+    if (f.firstFetch) {
+        f.firstFetch = false;
+        return;
+    }
+
+    for (int i=0; i<8; i++) {
+        int bit = 7 - i;
+        f.bg[i] = ((f.lo >> bit) & 1) | (((f.hi >> bit) & 1) << 1);
+    }
+
+    f.bgHead = 0;
+    f.bgCount = 8;
+    f.fetchX++;
+}
+
+//earlier sprites keep their pixels, lineSprites is already in priority order.
+static void mergeSprite(Machine &m, Fifo &f, const OAMEntry *sprite) {
+    bool tall = spriteSize8x16(m);
+    int row = (f.line + 16 - sprite->y) & (tall ? 15 : 7);
+    byte tile = sprite->tile;
+
+    if (sprite->flags & 0x40) {
+        row = (tall ? 15 : 7) - row;
+    }
+
+    if (tall) {
+        tile = (tile & 0xFE) | (row >> 3);
+        row &= 7;
+    }
+
+    const byte *data = m.ram + 0x8000 + (tile * 16) + (row * 2);
+
+    for (int px=0; px<8; px++) {
+        int i = sprite->x - 8 + px - f.x;
+
+        if (i < 0) {
+            continue;
+        }
+
+        int bit = (sprite->flags & 0x20) ? px : 7 - px;
+        byte c = ((data[0] >> bit) & 1) | (((data[1] >> bit) & 1) << 1);
+
+        if (c && !f.obj[i]) {
+            f.obj[i] = c;
+            f.objAttr[i] = sprite->flags;
+        }
+    }
+}
+
+static void startWindow(Machine &m, Fifo &f) {
+    int wx = m.ram[0xFF4B];
+
+    f.window = true;
+    f.bgCount = 0;
+    f.fetchDot = 0;
+    f.fetchX = 0;
+
+    //with WX below 7 the window starts left of the screen.
+    f.discard = f.x + 7 - wx;
+}
+
+static void outputPixel(Machine &m, Fifo &f, uint32_t *out) {
+    byte b = f.bg[f.bgHead++];
+    f.bgCount--;
+
+    if (f.discard) {
+        f.discard--;
+        return;
+    }
+
+    byte o = spriteDisplay(m) ? f.obj[0] : 0;
+    byte attr = f.objAttr[0];
+
+    memmove(f.obj, f.obj + 1, 7);
+    memmove(f.objAttr, f.objAttr + 1, 7);
+    f.obj[7] = 0;
+
+    if (!bgDisplay(m)) {
+        b = 0;
+    }
+
+    if (out) {
+        bool visible = o && !((attr & 0x80) && b);
+        byte palette = m.ram[visible ? ((attr & 0x10) ? 0xFF49 : 0xFF48) : 0xFF47];
+
+        byte shade = (palette >> ((visible ? o : b) * 2)) & 3;
+
+        if (m.ppu.indexBuffer) {
+            m.ppu.indexBuffer[f.line * XRES + f.x] = shade;
+        } else {
+            out[f.x] = compositor::colors[shade];
+        }
+    }
+
+    f.x++;
+    f.done = f.x == XRES;
+}
+
+//one dot of mode 3, out is null for a dry run.
+static void stepDot(Machine &m, Fifo &f, uint32_t *out) {
+    f.dot++;
+
+    if (f.spriteDots) {
+        stepFetcher(m, f);
+
+        if (--f.spriteDots == 0) {
+            mergeSprite(m, f, m.ppu.lineSprites[f.nextSprite++]);
+        }
+
+        return;
+    }
+
+    if (!f.window && !f.discard && bgDisplay(m) && windowDisplay(m) && f.line >= m.ram[0xFF4A] && f.x + 7 >= m.ram[0xFF4B]) {
+        startWindow(m, f);
+    }
+
+    //a sprite waits for the fetcher to finish the row it is on.
+    if (f.bgCount && !f.discard && spriteDisplay(m) && f.nextSprite < m.ppu.lineSpriteCount &&
+        m.ppu.lineSprites[f.nextSprite]->x <= f.x + 8) {
+
+        f.spriteDots = 6 + std::max(0, 5 - f.fetchDot);
+        return;
+    }
+
+    if (f.bgCount) {
+        outputPixel(m, f, out);
+    }
+
+    stepFetcher(m, f);
+}
+
+static void runUntil(Machine &m, int dot) {
+    Fifo &fifo = m.ppu.fifo;
+    uint32_t *out = m.ppu.videoBuffer + (fifo.line * XRES);
+
+    while (!fifo.done && fifo.dot < dot) {
+        stepDot(m, fifo, out);
+    }
+}
+
+/*
+  The length of mode 3 is worked out up front by running the line on a copy
+  with the registers as they are now.  A write during the line can make the
+  real run a little shorter or longer, it still ends at this event.  On a
+  skipped frame the dry run is all there is.
+*/
+void FifoRenderer::beginTransfer(Machine &m, int lineNum, uint64_t when) {
+    State &p = m.ppu;
+    Fifo &fifo = p.fifo;
+
+    memset(&fifo, 0, sizeof(fifo));
+    fifo.line = lineNum;
+    fifo.firstFetch = true;
+    fifo.discard = getXScroll(m) & 7;
+
+    Fifo dry = fifo;
+
+    while (!dry.done && dry.dot < MAX_TRANSFER_DOTS) {
+        stepDot(m, dry, nullptr);
+    }
+
+    p.transferLength = std::max(PIXEL_TICKS, (dry.dot + 3) / 4);
+    p.transferStart = when;
+    p.fifoActive = p.renderFrame;
+}
+
+int FifoRenderer::transferTicks(Machine &m) {
+    return m.ppu.transferLength;
+}
+
+void FifoRenderer::endTransfer(Machine &m, int lineNum) {
+    State &p = m.ppu;
+
+    if (!p.fifoActive) {
+        return;
+    }
+
+    runUntil(m, MAX_TRANSFER_DOTS);
+
+    if (p.fifo.window) {
+        p.windowLine++;
+    }
+
+    p.fifoActive = false;
+}
+
+void FifoRenderer::sync(Machine &m) {
+    State &p = m.ppu;
+    uint64_t now = cpu::getTickCount(m);
+
+    if (p.fifoActive && now > p.transferStart) {
+        runUntil(m, (now - p.transferStart) * 4);
+    }
+}
+
+}
@@ -0,0 +1,253 @@
+#include "scaler.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace dsemu::scaler {
+
+/*
+  The Scale2x/3x rules are written once against these, so the same kernel
+  runs one pixel at a time or four.
+*/
+struct ScalarOps {
+    typedef uint32_t V;
+    typedef bool M;
+    static const int LANES = 1;
+
+    static V load(const uint32_t *p) { return *p; }
+    static M eq(V a, V b) { return a == b; }
+    static M ne(V a, V b) { return a != b; }
+    static M both(M a, M b) { return a && b; }
+    static M either(M a, M b) { return a || b; }
+    static V pick(M m, V a, V b) { return m ? a : b; }
+
+    static void store2(uint32_t *dst, V a, V b) {
+        dst[0] = a;
+        dst[1] = b;
+    }
+
+    static void store3(uint32_t *dst, V a, V b, V c) {
+        dst[0] = a;
+        dst[1] = b;
+        dst[2] = c;
+    }
+};
+
+#ifdef __SSE2__
+
+struct SSE2Ops {
+    typedef __m128i V;
+    typedef __m128i M;
+    static const int LANES = 4;
+
+    static V load(const uint32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+    static M eq(V a, V b) { return _mm_cmpeq_epi32(a, b); }
+    static M ne(V a, V b) { return _mm_xor_si128(_mm_cmpeq_epi32(a, b), _mm_set1_epi32(-1)); }
+    static M both(M a, M b) { return _mm_and_si128(a, b); }
+    static M either(M a, M b) { return _mm_or_si128(a, b); }
+    static V pick(M m, V a, V b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+
+    static void store2(uint32_t *dst, V a, V b) {
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi32(a, b));
+        _mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi32(a, b));
+    }
+
+    //no cheap 3 way interleave in SSE2, the rules are the expensive part anyway.
+    static void store3(uint32_t *dst, V a, V b, V c) {
+        alignas(16) uint32_t pa[4], pb[4], pc[4];
+
+        _mm_store_si128((__m128i *)pa, a);
+        _mm_store_si128((__m128i *)pb, b);
+        _mm_store_si128((__m128i *)pc, c);
+
+        for (int i=0; i<4; i++) {
+            dst[i * 3] = pa[i];
+            dst[i * 3 + 1] = pb[i];
+            dst[i * 3 + 2] = pc[i];
+        }
+    }
+};
+
+typedef SSE2Ops Ops;
+
+#else
+
+typedef ScalarOps Ops;
+
+#endif
+
+//row with its first and last pixel repeated, so x - 1 and x + 1 are always there.
+static void padRow(const uint32_t *row, int w, uint32_t *out) {
+    out[0] = row[0];
+    memcpy(out + 1, row, w * sizeof(uint32_t));
+    out[w + 1] = row[w - 1];
+}
+
+/*
+  Neighbours of E:
+      A B C
+      D E F
+      G H I
+*/
+template<class O>
+static void scale2xRow(const uint32_t *prev, const uint32_t *cur, const uint32_t *next, int w, uint32_t *out0, uint32_t *out1) {
+    typedef typename O::V V;
+    typedef typename O::M M;
+
+    for (int x=0; x<w; x += O::LANES) {
+        V b = O::load(prev + x + 1);
+        V d = O::load(cur + x);
+        V e = O::load(cur + x + 1);
+        V f = O::load(cur + x + 2);
+        V h = O::load(next + x + 1);
+
+        M edge = O::both(O::ne(b, h), O::ne(d, f));
+
+        O::store2(out0 + (x * 2), O::pick(O::both(edge, O::eq(d, b)), d, e), O::pick(O::both(edge, O::eq(b, f)), f, e));
+        O::store2(out1 + (x * 2), O::pick(O::both(edge, O::eq(d, h)), d, e), O::pick(O::both(edge, O::eq(h, f)), f, e));
+    }
+}
+
+template<class O>
+static void scale3xRow(const uint32_t *prev, const uint32_t *cur, const uint32_t *next, int w, uint32_t *out0, uint32_t *out1, uint32_t *out2) {
+    typedef typename O::V V;
+    typedef typename O::M M;
+
+    for (int x=0; x<w; x += O::LANES) {
+        V a = O::load(prev + x);
+        V b = O::load(prev + x + 1);
+        V c = O::load(prev + x + 2);
+        V d = O::load(cur + x);
+        V e = O::load(cur + x + 1);
+        V f = O::load(cur + x + 2);
+        V g = O::load(next + x);
+        V h = O::load(next + x + 1);
+        V i = O::load(next + x + 2);
+
+        M edge = O::both(O::ne(b, h), O::ne(d, f));
+        M db = O::both(edge, O::eq(d, b));
+        M bf = O::both(edge, O::eq(b, f));
+        M dh = O::both(edge, O::eq(d, h));
+        M hf = O::both(edge, O::eq(h, f));
+
+        O::store3(out0 + (x * 3),
+            O::pick(db, d, e),
+            O::pick(O::either(O::both(db, O::ne(e, c)), O::both(bf, O::ne(e, a))), b, e),
+            O::pick(bf, f, e));
+        O::store3(out1 + (x * 3),
+            O::pick(O::either(O::both(db, O::ne(e, g)), O::both(dh, O::ne(e, a))), d, e),
+            e,
+            O::pick(O::either(O::both(bf, O::ne(e, i)), O::both(hf, O::ne(e, c))), f, e));
+        O::store3(out2 + (x * 3),
+            O::pick(dh, d, e),
+            O::pick(O::either(O::both(dh, O::ne(e, i)), O::both(hf, O::ne(e, g))), h, e),
+            O::pick(hf, f, e));
+    }
+}
+
+void scale2x(const uint32_t *src, int w, int h, uint32_t *dst) {
+    vector<uint32_t> rows(3 * (w + 2));
+    uint32_t *prev = rows.data();
+    uint32_t *cur = prev + w + 2;
+    uint32_t *next = cur + w + 2;
+
+    for (int y=0; y<h; y++) {
+        padRow(src + (y ? y - 1 : 0) * w, w, prev);
+        padRow(src + y * w, w, cur);
+        padRow(src + (y + 1 < h ? y + 1 : y) * w, w, next);
+
+        uint32_t *out = dst + (y * 2) * (w * 2);
+        scale2xRow<Ops>(prev, cur, next, w, out, out + (w * 2));
+    }
+}
+
+void scale3x(const uint32_t *src, int w, int h, uint32_t *dst) {
+    vector<uint32_t> rows(3 * (w + 2));
+    uint32_t *prev = rows.data();
+    uint32_t *cur = prev + w + 2;
+    uint32_t *next = cur + w + 2;
+
+    for (int y=0; y<h; y++) {
+        padRow(src + (y ? y - 1 : 0) * w, w, prev);
+        padRow(src + y * w, w, cur);
+        padRow(src + (y + 1 < h ? y + 1 : y) * w, w, next);
+
+        uint32_t *out = dst + (y * 3) * (w * 3);
+        scale3xRow<Ops>(prev, cur, next, w, out, out + (w * 3), out + (w * 6));
+    }
+}
+
+//one row widened n times, the other n - 1 rows are copies of it.
+static void widenRow(const uint32_t *src, int w, int n, uint32_t *dst) {
+#ifdef __SSE2__
+    if (n == 2) {
+        for (int x=0; x<w; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+            _mm_storeu_si128((__m128i *)(dst + x * 2), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i *)(dst + x * 2 + 4), _mm_unpackhi_epi32(v, v));
+        }
+
+        return;
+    }
+
+    //two overlapping stores of the broadcast pixel cover 4 to 8 copies.
+    if (n >= 4) {
+        for (int x=0; x<w; x++) {
+            __m128i v = _mm_set1_epi32(src[x]);
+            _mm_storeu_si128((__m128i *)(dst + x * n), v);
+            _mm_storeu_si128((__m128i *)(dst + x * n + n - 4), v);
+        }
+
+        return;
+    }
+#endif
+
+    for (int x=0; x<w; x++) {
+        for (int i=0; i<n; i++) {
+            dst[x * n + i] = src[x];
+        }
+    }
+}
+
+void nearest(const uint32_t *src, int w, int h, int n, uint32_t *dst) {
+    int pitch = w * n;
+
+    for (int y=0; y<h; y++) {
+        uint32_t *out = dst + (y * n) * pitch;
+
+        widenRow(src + y * w, w, n, out);
+
+        for (int i=1; i<n; i++) {
+            memcpy(out + i * pitch, out, pitch * sizeof(uint32_t));
+        }
+    }
+}
+
+bool parse(const string &name, Filter &filter, int &factor) {
+    if (name == "scale2x" || name == "scale3x") {
+        filter = name == "scale2x" ? FilterScale2x : FilterScale3x;
+        factor = name == "scale2x" ? 2 : 3;
+        return true;
+    }
+
+    if (name.size() == 8 && name.compare(0, 7, "nearest") == 0 && name[7] >= '1' && name[7] <= '6') {
+        filter = FilterNearest;
+        factor = name[7] - '0';
+        return true;
+    }
+
+    return false;
+}
+
+void scale(Filter filter, int factor, const uint32_t *src, int w, int h, uint32_t *dst) {
+    switch(filter) {
+        case FilterNearest: nearest(src, w, h, factor, dst); break;
+        case FilterScale2x: scale2x(src, w, h, dst); break;
+        case FilterScale3x: scale3x(src, w, h, dst); break;
+    }
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common.h"
+
+/*
+  CPU scalers for 32 bit frames, for screenshots and recordings where the
+  pixels are needed in memory.  The window itself is scaled by SDL.
+
+  The width must be a multiple of 4, dst is (w * n) x (h * n) pixels for a
+  scale factor of n.  With SSE2 four source pixels are done at a time,
+  other targets get the scalar versions.
+*/
+
+namespace dsemu::scaler {
+
+enum Filter {
+    FilterNearest,
+    FilterScale2x,
+    FilterScale3x
+};
+
+//each pixel becomes an n x n block, n from 1 to 6.
+void nearest(const uint32_t *src, int w, int h, int n, uint32_t *dst);
+
+//AdvMAME2x/3x, edges are smoothed but no colours are blended.
+void scale2x(const uint32_t *src, int w, int h, uint32_t *dst);
+void scale3x(const uint32_t *src, int w, int h, uint32_t *dst);
+
+//"nearest2" to "nearest6", "scale2x" or "scale3x", false if the name is not one of them.
+bool parse(const string &name, Filter &filter, int &factor);
+
+void scale(Filter filter, int factor, const uint32_t *src, int w, int h, uint32_t *dst);
+
+}
@@ -0,0 +1,64 @@
+#include "scheduler.h"
+
+namespace dsemu::scheduler {
+
+static void updateNext(State &s) {
+    s.nextEvent = NEVER;
+
+    for (int i=0; i<EventCount; i++) {
+        if (s.deadlines[i] < s.nextEvent) {
+            s.nextEvent = s.deadlines[i];
+        }
+    }
+}
+
+void init(Machine &m) {
+    State &s = m.scheduler;
+
+    for (int i=0; i<EventCount; i++) {
+        s.deadlines[i] = NEVER;
+        s.handlers[i] = nullptr;
+    }
+
+    s.nextEvent = NEVER;
+}
+
+void setHandler(Machine &m, Event e, EVENT_HANDLER handler) {
+    m.scheduler.handlers[e] = handler;
+}
+
+void add(Machine &m, Event e, uint64_t when) {
+    m.scheduler.deadlines[e] = when;
+    updateNext(m.scheduler);
+}
+
+void cancel(Machine &m, Event e) {
+    m.scheduler.deadlines[e] = NEVER;
+    updateNext(m.scheduler);
+}
+
+uint64_t pending(const Machine &m, Event e) {
+    return m.scheduler.deadlines[e];
+}
+
+void runDue(Machine &m, uint64_t now) {
+    State &s = m.scheduler;
+
+    while (s.nextEvent <= now) {
+        int e = 0;
+
+        for (int i=1; i<EventCount; i++) {
+            if (s.deadlines[i] < s.deadlines[e]) {
+                e = i;
+            }
+        }
+
+        uint64_t when = s.deadlines[e];
+        s.deadlines[e] = NEVER;
+        updateNext(s);
+
+        s.handlers[e](m, when);
+    }
+}
+
+}
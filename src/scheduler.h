@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+/*
+  Central cycle scheduler.
+
+  Every peripheral that needs to do something at a given M-cycle (PPU mode
+  and line changes, timer overflow) registers a handler and schedules its next
+  deadline here.  The CPU runs whole instructions until the earliest pending
+  deadline, then the due handlers are called in time order.
+
+  Each event source has at most one pending deadline, so this is a small
+  fixed table with the minimum cached rather than a heap.
+*/
+
+namespace dsemu::scheduler {
+
+void init(Machine &m);
+void setHandler(Machine &m, Event e, EVENT_HANDLER handler);
+void add(Machine &m, Event e, uint64_t when);
+void cancel(Machine &m, Event e);
+uint64_t pending(const Machine &m, Event e);
+
+//call every handler whose deadline is <= now.
+void runDue(Machine &m, uint64_t now);
+
+inline uint64_t next(const Machine &m) { return m.scheduler.nextEvent; }
+
+}
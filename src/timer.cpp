@@ -0,0 +1,114 @@
+#include "timer.h"
+#include "cpu.h"
+#include "scheduler.h"
+
+namespace dsemu::timer {
+
+//TIMA period in M-cycles for each TAC clock select.
+static const uint64_t periods[4] = {256, 4, 16, 64};
+
+const uint64_t DIV_PERIOD = 64;
+
+inline bool enabled(const State &t) { return t.tac & 4; }
+inline uint64_t period(const State &t) { return periods[t.tac & 3]; }
+
+//TIMA ticks are aligned to the DIV counter.
+inline uint64_t timaTicks(const State &t, uint64_t cycle) {
+    return (cycle - t.divBase) / period(t);
+}
+
+//bring t.tima up to date with the current cycle.
+void sync(Machine &m) {
+    State &t = m.timer;
+    uint64_t now = cpu::getTickCount(m);
+
+    if (enabled(t)) {
+        t.tima += timaTicks(t, now) - timaTicks(t, t.timaSync);
+    }
+
+    t.timaSync = now;
+}
+
+void scheduleOverflow(Machine &m) {
+    State &t = m.timer;
+    if (!enabled(t)) {
+        scheduler::cancel(m, scheduler::EventTimer);
+        return;
+    }
+
+    uint64_t tick = timaTicks(t, t.timaSync) + (0x100 - t.tima);
+    scheduler::add(m, scheduler::EventTimer, t.divBase + (tick * period(t)));
+}
+
+void onOverflow(Machine &m, uint64_t when) {
+    State &t = m.timer;
+    t.tima = t.tma;
+    t.timaSync = when;
+    scheduleOverflow(m);
+
+    cpu::handleInterrupt(m, cpu::ITimer, true, false);
+}
+
+void init(Machine &m) {
+    State &t = m.timer;
+    t.divBase = cpu::getTickCount(m);
+    t.timaSync = t.divBase;
+    t.tima = 0;
+    t.tma = 0;
+    t.tac = 0;
+
+    scheduler::setHandler(m, scheduler::EventTimer, onOverflow);
+    scheduleOverflow(m);
+}
+
+byte readDIV(Machine &m) {
+    State &t = m.timer;
+    m.cpu.volatileAccess = true;
+    return ((cpu::getTickCount(m) - t.divBase) / DIV_PERIOD) & 0xFF;
+}
+
+void writeDIV(Machine &m, byte b) {
+    State &t = m.timer;
+    sync(m);
+    t.divBase = cpu::getTickCount(m);
+    t.timaSync = t.divBase;
+    scheduleOverflow(m);
+}
+
+byte readTIMA(Machine &m) {
+    State &t = m.timer;
+    m.cpu.volatileAccess = true;
+    sync(m);
+    return t.tima;
+}
+
+void writeTIMA(Machine &m, byte b) {
+    State &t = m.timer;
+    sync(m);
+    t.tima = b;
+    scheduleOverflow(m);
+}
+
+byte readTMA(Machine &m) {
+    State &t = m.timer;
+    return t.tma;
+}
+
+void writeTMA(Machine &m, byte b) {
+    State &t = m.timer;
+    t.tma = b;
+}
+
+byte readTAC(Machine &m) {
+    State &t = m.timer;
+    return t.tac | 0xF8;
+}
+
+void writeTAC(Machine &m, byte b) {
+    State &t = m.timer;
+    sync(m);
+    t.tac = b & 7;
+    scheduleOverflow(m);
+}
+
+}
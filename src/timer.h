@@ -0,0 +1,24 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+/*
+  DIV/TIMA/TMA/TAC.  Nothing is counted per cycle: DIV is derived from the
+  cycle counter and TIMA overflow is a scheduler event.
+*/
+
+namespace dsemu::timer {
+
+void init(Machine &m);
+
+byte readDIV(Machine &m);
+void writeDIV(Machine &m, byte b);
+byte readTIMA(Machine &m);
+void writeTIMA(Machine &m, byte b);
+byte readTMA(Machine &m);
+void writeTMA(Machine &m, byte b);
+byte readTAC(Machine &m);
+void writeTAC(Machine &m, byte b);
+
+}
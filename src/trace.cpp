@@ -0,0 +1,137 @@
+#include "trace.h"
+#include "opcodes.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dsemu::trace {
+
+#if DSEMU_TRACE
+
+static const Ring *dumpRing = nullptr;
+static char dumpFile[4096];
+
+void enable(Ring &t, uint64_t capacity) {
+    uint64_t size = 1;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    delete[] t.records;
+    t.records = new Record[size];
+    memset(t.records, 0, size * sizeof(Record));
+    t.mask = size - 1;
+    t.head = 0;
+    t.enabled = true;
+
+    cout << "Tracing last " << size << " instructions" << endl;
+}
+
+static bool writeAll(int fd, const void *data, size_t len) {
+    const char *p = (const char *)data;
+
+    while (len) {
+        ssize_t n = ::write(fd, p, len);
+
+        if (n <= 0) {
+            return false;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+//only uses open/write so it is safe to call from a signal handler.
+bool dump(const Ring &t, const char *file) {
+    if (t.records == nullptr) {
+        return false;
+    }
+
+    int fd = ::open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    uint64_t size = t.mask + 1;
+    uint64_t count = t.head < size ? t.head : size;
+    uint64_t first = t.head - count;
+
+    FileHeader hdr;
+    memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+    hdr.recordSize = sizeof(Record);
+    hdr.first = first + 1;
+    hdr.count = count;
+
+    bool ok = writeAll(fd, &hdr, sizeof(hdr));
+
+    //oldest records are the ones just after the write position.
+    uint64_t start = first & t.mask;
+    uint64_t tail = std::min(count, size - start);
+
+    ok = ok && writeAll(fd, t.records + start, tail * sizeof(Record));
+    ok = ok && writeAll(fd, t.records, (count - tail) * sizeof(Record));
+
+    ::close(fd);
+    return ok;
+}
+
+static void dumpAtExit() {
+    if (dump(*dumpRing, dumpFile)) {
+        cout << "Trace written to " << dumpFile << endl;
+    }
+}
+
+static void dumpOnSignal(int sig) {
+    dump(*dumpRing, dumpFile);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void dumpOnExit(Ring &t, const string &file) {
+    dumpRing = &t;
+    strncpy(dumpFile, file.c_str(), sizeof(dumpFile) - 1);
+
+    atexit(dumpAtExit);
+
+    for (int sig : {SIGSEGV, SIGABRT, SIGFPE, SIGILL, SIGBUS, SIGINT, SIGTERM}) {
+        signal(sig, dumpOnSignal);
+    }
+}
+
+#else
+
+void enable(Ring &t, uint64_t capacity) {
+    cout << "Tracing was compiled out (DSEMU_TRACE=0)" << endl;
+}
+
+void dumpOnExit(Ring &t, const string &file) {
+}
+
+bool dump(const Ring &t, const char *file) {
+    return false;
+}
+
+#endif
+
+void print(std::ostream &os, uint64_t seq, const Record &r) {
+    os << Int64(seq) << ": " << Short(r.pc) << ": " << Byte(r.opcode) << " " << Byte(r.operands[0]) << " " << Byte(r.operands[1]) << " (" << std::left << std::setfill(' ') << std::setw(10) << cpu::opCodes[r.opcode].name << ") "
+            << std::right
+            << " - AF: " << Short(r.af)
+            << " - BC: " << Short(r.bc)
+            << " - DE: " << Short(r.de)
+            << " - HL: " << Short(r.hl)
+            << " - SP: " << Short(r.sp)
+            << " - Cycles: " << r.cycles
+            << endl;
+}
+
+}
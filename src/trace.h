@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+/*
+  Instruction trace.
+
+  Each executed instruction is stored as a fixed size binary record in a
+  preallocated ring buffer, so the last N instructions are always available
+  to dump after a crash.  Each Machine has its own ring.  Build with
+  -DDSEMU_TRACE=0 to compile it out entirely, otherwise it is switched on at
+  run time with enable().
+
+  tools/trace_decode.cpp turns a dump back into the text format that the
+  DEBUG output uses.
+*/
+
+#ifndef DSEMU_TRACE
+#define DSEMU_TRACE 1
+#endif
+
+namespace dsemu::trace {
+
+struct Record {
+    uint64_t cycles;
+    ushort pc;
+    ushort af;
+    ushort bc;
+    ushort de;
+    ushort hl;
+    ushort sp;
+    byte opcode;
+    byte operands[2];
+    byte reserved;
+};
+
+static_assert(sizeof(Record) == 24, "trace records are written to disk as is");
+
+struct FileHeader {
+    char magic[4];
+    uint32_t recordSize;
+    uint64_t first;
+    uint64_t count;
+};
+
+const char MAGIC[4] = {'D', 'S', 'T', 'R'};
+
+#if DSEMU_TRACE
+
+inline bool enabled(const Ring &t) {
+    return t.enabled;
+}
+
+inline void push(Ring &t, const Record &r) {
+    t.records[t.head++ & t.mask] = r;
+}
+
+#else
+
+constexpr bool enabled(const Ring &t) {
+    return false;
+}
+
+inline void push(Ring &t, const Record &r) {}
+
+#endif
+
+//capacity is rounded up to a power of two records.
+void enable(Ring &t, uint64_t capacity);
+
+//dump to file at exit and on fatal signals.  One ring per process.
+void dumpOnExit(Ring &t, const string &file);
+
+bool dump(const Ring &t, const char *file);
+
+void print(std::ostream &os, uint64_t seq, const Record &r);
+
+}
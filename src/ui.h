@@ -1,12 +1,25 @@
 #pragma once
 
 #include "common.h"
+#include "scaler.h"
+#include "machine.h"
 
 namespace dsemu::ui {
     const int SCREEN_WIDTH = 1024;
     const int SCREEN_HEIGHT = 768;
 
+    //filter and scale factor of F12 screenshots.
+    extern scaler::Filter grabFilter;
+    extern int grabFactor;
+
+    //open the tile/map/OAM viewer at start, F1 toggles it.
+    extern bool showViewer;
+
+    //speed multiplier while TAB is held.
+    extern double turbo;
+
     void init();
-    void update();
-    void handleEvents();
+    //present a 160x144 ARGB8888 frame.
+    void update(Machine &m, const uint32_t *frame);
+    void handleEvents(Machine &m);
 }
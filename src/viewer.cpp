@@ -0,0 +1,192 @@
+#include "viewer.h"
+#include "ppu.h"
+#include "memory.h"
+#include "compositor.h"
+
+#include <cstring>
+#include <algorithm>
+#include <SDL2/SDL.h>
+
+namespace dsemu::viewer {
+
+//tiles 16x24, the 32x32 map, then sprites in 8 columns of 10x18 cells.
+const int TILES_X = 0;
+const int MAP_X = 16 * 8 + 8;
+const int OAM_X = MAP_X + 256 + 8;
+const int OAM_CELL_W = 10;
+const int OAM_CELL_H = 18;
+const int WIDTH = OAM_X + (8 * OAM_CELL_W);
+const int HEIGHT = 256;
+const int SCALE = 2;
+
+const uint32_t BORDER = 0xFF404040;
+
+static SDL_Window *window = nullptr;
+static SDL_Renderer *renderer;
+static SDL_Texture *texture;
+
+static uint32_t pixels[WIDTH * HEIGHT];
+
+//VRAM, OAM and LCDC as they were drawn last time.
+static byte vram[0x2000];
+static byte oam[160];
+static byte lcdc;
+static bool full;
+
+static bool tileChanged[ppu::TILE_COUNT];
+
+static void drawTile(int tile, int x, int y, byte flags) {
+    const byte *data = vram + (tile * 16);
+
+    for (int row=0; row<8; row++) {
+        int src = (flags & 0x40) ? 7 - row : row;
+        byte lo = data[src * 2];
+        byte hi = data[src * 2 + 1];
+        uint32_t *out = pixels + ((y + row) * WIDTH) + x;
+
+        for (int px=0; px<8; px++) {
+            int bit = (flags & 0x20) ? px : 7 - px;
+            out[px] = compositor::colors[((lo >> bit) & 1) | (((hi >> bit) & 1) << 1)];
+        }
+    }
+}
+
+static void fill(int x, int y, int w, int h, uint32_t color) {
+    for (int row=y; row<y + h; row++) {
+        std::fill(pixels + (row * WIDTH) + x, pixels + (row * WIDTH) + x + w, color);
+    }
+}
+
+static bool updateTiles(Machine &m) {
+    bool any = false;
+
+    for (int t=0; t<ppu::TILE_COUNT; t++) {
+        const byte *src = m.ram + 0x8000 + (t * 16);
+
+        tileChanged[t] = full || memcmp(src, vram + (t * 16), 16);
+
+        if (tileChanged[t]) {
+            memcpy(vram + (t * 16), src, 16);
+            drawTile(t, TILES_X + ((t % 16) * 8), (t / 16) * 8, 0);
+            any = true;
+        }
+    }
+
+    return any;
+}
+
+//an entry is drawn again when it changed or the tile it shows did.
+static bool updateMap(Machine &m, byte control, bool layout) {
+    bool any = false;
+    ushort base = (control & 0x08) ? 0x1C00 : 0x1800;
+
+    for (int i=0; i<32 * 32; i++) {
+        byte n = m.ram[0x8000 + base + i];
+        int tile = (control & 0x10) ? n : 256 + (int8_t)n;
+
+        if (full || layout || vram[base + i] != n || tileChanged[tile]) {
+            vram[base + i] = n;
+            drawTile(tile, MAP_X + ((i % 32) * 8), (i / 32) * 8, 0);
+            any = true;
+        }
+    }
+
+    return any;
+}
+
+static bool updateOAM(Machine &m, byte control, bool layout) {
+    bool any = false;
+    bool tall = control & 0x04;
+
+    for (int i=0; i<40; i++) {
+        const byte *entry = m.oamRAM + (i * 4);
+        byte tile = tall ? entry[2] & 0xFE : entry[2];
+        bool changed = full || layout || memcmp(entry, oam + (i * 4), 4) || tileChanged[tile] || (tall && tileChanged[tile + 1]);
+
+        if (!changed) {
+            continue;
+        }
+
+        memcpy(oam + (i * 4), entry, 4);
+
+        int x = OAM_X + ((i % 8) * OAM_CELL_W) + 1;
+        int y = (i / 8) * OAM_CELL_H + 1;
+        byte flags = entry[3];
+
+        fill(x, y, 8, 16, BORDER);
+
+        if (tall) {
+            bool flip = flags & 0x40;
+            drawTile(flip ? tile + 1 : tile, x, y, flags);
+            drawTile(flip ? tile : tile + 1, x, y + 8, flags);
+        } else {
+            drawTile(tile, x, y, flags);
+        }
+
+        any = true;
+    }
+
+    return any;
+}
+
+void open(int x, int y) {
+    if (window) {
+        return;
+    }
+
+    window = SDL_CreateWindow("Tiles / BG map / OAM", x, y, WIDTH * SCALE, HEIGHT * SCALE, SDL_WINDOW_RESIZABLE);
+    renderer = SDL_CreateRenderer(window, -1, 0);
+
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+    SDL_RenderSetLogicalSize(renderer, WIDTH, HEIGHT);
+
+    fill(0, 0, WIDTH, HEIGHT, BORDER);
+    full = true;
+}
+
+void close() {
+    if (!window) {
+        return;
+    }
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    window = nullptr;
+}
+
+bool isOpen() {
+    return window != nullptr;
+}
+
+uint32_t windowID() {
+    return window ? SDL_GetWindowID(window) : 0;
+}
+
+void update(Machine &m) {
+    if (!window) {
+        return;
+    }
+
+    byte control = m.ppu.lcdControl;
+    bool layout = (control ^ lcdc) & 0x1C;
+
+    //the map and OAM passes need to know which tiles changed, so tiles go first.
+    bool changed = updateTiles(m);
+    changed |= updateMap(m, control, layout);
+    changed |= updateOAM(m, control, layout);
+
+    lcdc = control;
+    full = false;
+
+    if (changed) {
+        SDL_UpdateTexture(texture, NULL, pixels, WIDTH * sizeof(uint32_t));
+    }
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+#include "machine.h"
+
+/*
+  Debug viewer window: the 384 VRAM tiles, the BG map LCDC selects and the
+  40 OAM sprites.
+
+  It only exists while it is open, nothing is created or drawn otherwise.
+  On each present VRAM and OAM are compared with the copy taken at the last
+  one and only the tiles, map entries and sprites that changed are drawn
+  again, so the emulator itself does no bookkeeping for it.
+*/
+
+namespace dsemu::viewer {
+
+void open(int x, int y);
+void close();
+bool isOpen();
+
+//SDL window id, 0 while closed.
+uint32_t windowID();
+
+//redraw what changed and present, does nothing while closed.
+void update(Machine &m);
+
+}
@@ -0,0 +1,93 @@
+#include "compositor.h"
+
+#include <cstring>
+#include <random>
+
+/*
+  Checks every compositor backend the CPU supports, and composeIndex(),
+  against a plain per pixel model on random lines.  Exits non zero on the
+  first mismatch.
+
+  usage: compositor_test [lines] [seed]
+*/
+
+using namespace dsemu;
+using namespace dsemu::compositor;
+
+//what the PPU guarantees: obj is 0 wherever the mask is clear.
+static void randomLine(std::mt19937 &rng, Line &line, int coverage) {
+    memset(&line, 0, sizeof(line));
+
+    for (int x=0; x<WIDTH; x++) {
+        line.bg[x] = rng() & 3;
+
+        if ((int)(rng() % 100) < coverage) {
+            line.obj[x] = rng() & 3;
+            line.objAttr[x] = rng() & 0x90;
+            line.objMask[x >> 6] |= 1ULL << (x & 63);
+        }
+    }
+}
+
+static byte expectedShade(const Line &line, byte bgp, byte obp0, byte obp1, int x) {
+    byte obj = line.obj[x];
+    byte attr = line.objAttr[x];
+
+    if (obj && !((attr & 0x80) && line.bg[x])) {
+        return ((attr & 0x10 ? obp1 : obp0) >> (obj * 2)) & 3;
+    }
+
+    return (bgp >> (line.bg[x] * 2)) & 3;
+}
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? atoi(argv[1]) : 20000;
+    std::mt19937 rng(argc > 2 ? strtoul(argv[2], nullptr, 0) : 1);
+
+    //no sprites, a few, half and all of them, so both span paths run.
+    const int coverages[] = {0, 5, 50, 100};
+
+    Backend initial = current();
+    int failures = 0;
+
+    for (int b=0; b<BackendCount; b++) {
+        if (!select((Backend)b)) {
+            cout << name((Backend)b) << ": not supported, skipped" << endl;
+            continue;
+        }
+
+        int bad = 0;
+
+        for (int i=0; i<lines && !bad; i++) {
+            Line line;
+            randomLine(rng, line, coverages[i % 4]);
+
+            byte bgp = rng(), obp0 = rng(), obp1 = rng();
+            uint32_t out[WIDTH];
+            byte index[WIDTH];
+
+            compose(line, bgp, obp0, obp1, out);
+            composeIndex(line, bgp, obp0, obp1, index);
+
+            for (int x=0; x<WIDTH; x++) {
+                byte shade = expectedShade(line, bgp, obp0, obp1, x);
+
+                if (out[x] != colors[shade] || index[x] != shade) {
+                    cout << name((Backend)b) << ": line " << i << " pixel " << x
+                         << " bg " << (int)line.bg[x] << " obj " << (int)line.obj[x] << " attr " << Byte(line.objAttr[x])
+                         << " - expected shade " << (int)shade << ", got " << std::hex << out[x] << std::dec
+                         << " / index " << (int)index[x] << endl;
+                    bad++;
+                    break;
+                }
+            }
+        }
+
+        cout << name((Backend)b) << ": " << (bad ? "FAILED" : "ok") << endl;
+        failures += bad;
+    }
+
+    select(initial);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+#include "trace.h"
+
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+/*
+  Prints a binary trace dump in the same text format as the DEBUG output.
+
+  usage: trace_decode <dump file> [last N records]
+*/
+
+using namespace dsemu;
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cout << "usage: " << argv[0] << " <trace file> [count]" << endl;
+        return -1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+
+    if (!in) {
+        cout << "Unable to open trace: " << argv[1] << " - " << strerror(errno) << endl;
+        return -1;
+    }
+
+    trace::FileHeader hdr;
+    in.read((char *)&hdr, sizeof(hdr));
+
+    if (!in || memcmp(hdr.magic, trace::MAGIC, sizeof(trace::MAGIC)) || hdr.recordSize != sizeof(trace::Record)) {
+        cout << "Not a trace file: " << argv[1] << endl;
+        return -1;
+    }
+
+    uint64_t skip = 0;
+
+    if (argc > 2) {
+        uint64_t last = strtoull(argv[2], nullptr, 0);
+
+        if (last < hdr.count) {
+            skip = hdr.count - last;
+        }
+    }
+
+    in.seekg(skip * sizeof(trace::Record), in.cur);
+
+    trace::Record r;
+
+    for (uint64_t i=skip; i<hdr.count && in.read((char *)&r, sizeof(r)); i++) {
+        trace::print(cout, hdr.first + i, r);
+    }
+
+    return 0;
+}